@@ -0,0 +1,24 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "Core/Bench.h"
+
+// Runs one of the network benchmarks, "NetBench" alone lists them
+int main(int argc, char** argv)
+{
+  std::vector<rpc::bench::Bench>& benches = rpc::bench::GetBenches();
+  std::sort(benches.begin(), benches.end(), [](const rpc::bench::Bench& a, const rpc::bench::Bench& b) { return a.name < b.name; });
+
+  if (argc > 1)
+  {
+    for (const rpc::bench::Bench& bench : benches)
+      if (bench.name == argv[1])
+        return bench.run(std::vector<std::string>(argv + 2, argv + argc));
+    std::printf("No benchmark called '%s'\n\n", argv[1]);
+  }
+
+  std::printf("Usage: NetBench <benchmark> [arguments...]\n\n");
+  for (const rpc::bench::Bench& bench : benches)
+    std::printf("  %-12s %s\n", bench.name.c_str(), bench.description.c_str());
+  return argc > 1 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <atomic>
+#include <cstdio>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+    using ReadMode = net::connection<MessageType>::read_mode;
+
+    // Counts what arrives
+    class CountingServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      CountingServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      std::atomic<uint64_t> received = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        received++;
+      }
+    };
+
+    // One client sends "count" messages of "size" bytes, never more than "ahead" bytes
+    // of them queued, and the allocations made from the end of the warm-up tenth to the
+    // last message are split between the sending thread, which builds each message and
+    // its shared_message, and everything else, which is the library's I/O
+    bool RunAllocations(uint64_t count, size_t size, size_t ahead, ReadMode mode)
+    {
+      CountingServer server;
+      server.SetReadMode(mode);
+      if (!server.Start())
+        return false;
+
+      net::ClientInterface<MessageType> client;
+      client.Connect("127.0.0.1", bench::BenchPort);
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+        return false;
+
+      uint64_t warmup = count / 10;
+      std::atomic<bool> bWarm = false;
+      std::atomic<uint64_t> senderAllocations = 0;
+      std::thread sender([&]()
+        {
+          uint64_t allocationsBefore = 0;
+          for (uint64_t i = 0; i < count; i++)
+          {
+            if (i == warmup)
+            {
+              while (!bWarm)
+                std::this_thread::yield();
+              allocationsBefore = bench::GetThreadAllocationCount();
+            }
+            while (client.GetQueuedBytes() > ahead)
+              std::this_thread::yield();
+
+            net::message<MessageType> msg;
+            msg.header.id = MessageType::client_input_update;
+            msg.body.resize(size);
+            msg.header.size = static_cast<uint32_t>(size);
+            net::shared_message<MessageType> shared(std::move(msg));
+            while (!client.Send(shared))
+              std::this_thread::yield();
+          }
+          senderAllocations = bench::GetThreadAllocationCount() - allocationsBefore;
+        });
+
+      while (server.received < warmup)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+
+      uint64_t allocationsBefore = bench::GetAllocationCount();
+      net::buffer_pool_stats poolBefore = server.GetBufferPoolStats();
+      uint64_t receivedBefore = server.received;
+      bWarm = true;
+
+      auto start = std::chrono::steady_clock::now();
+      while (server.received < count && bench::MillisecondsSince(start) < 120000.0)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+      sender.join();
+      uint64_t allocations = bench::GetAllocationCount() - allocationsBefore;
+      net::buffer_pool_stats pool = server.GetBufferPoolStats();
+      uint64_t received = server.received - receivedBefore;
+
+      client.Disconnect();
+      server.Stop();
+
+      double perMessage = 1.0 / std::max<uint64_t>(received, 1);
+      std::printf("%-8s %8zu %9zu %10llu %10.3f %10.3f %10.3f %10llu\n", mode == ReadMode::buffered ? "buffered" : "exact", size, ahead / 1024,
+        static_cast<unsigned long long>(received), allocations * perMessage, senderAllocations * perMessage,
+        (allocations - senderAllocations) * perMessage, static_cast<unsigned long long>(pool.allocations - poolBefore.allocations));
+      return server.received == count;
+    }
+
+    // Heap allocations per message over a million messages once the connection is warm.
+    // The sender's column is the message and its shared_message, built by the caller,
+    // the I/O column is what the library allocates to move them. It should be zero while
+    // the queues fit their rings, 256 KB of 64 byte messages fills the outgoing one and
+    // spills, which allocates
+    int AllocationBench(const std::vector<std::string>& args)
+    {
+      uint64_t count = bench::GetArg(args, 0, uint64_t(1000000));
+      size_t size = bench::GetArg(args, 1, uint64_t(64));
+
+      std::printf("%-8s %8s %9s %10s %10s %10s %10s %10s\n", "reads", "size", "ahead KB", "messages", "allocs/msg", "sender", "i/o", "pool new");
+      bool bOk = true;
+      for (ReadMode mode : { ReadMode::exact, ReadMode::buffered })
+        for (size_t ahead : { 16 * 1024, 256 * 1024 })
+          bOk &= RunAllocations(count, size, ahead, mode);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("allocations", "[count] [size] - heap allocations per message over a million messages, the sender's and the I/O's", AllocationBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    // Set up the way ParentClient sets up its server, and counts each child's frames
+    // instead of decoding them
+    class ParentServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      ParentServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+        SetReadMode(net::connection<MessageType>::read_mode::buffered);
+        SetThreadCount(std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+        SetAcceptorCount(2);
+        SetDatagramTransport(true);
+      }
+
+      // Frames by connection ID, only touched from Update
+      std::map<uint32_t, size_t> frames;
+      std::atomic<size_t> accepted = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        accepted++;
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        if (msg.header.id == MessageType::client_frame_pixels_update)
+          frames[client->GetID()]++;
+      }
+    };
+
+    // "children" clients set up the way ChildNetClient is, each sending a frame of
+    // "frameSize" bytes "fps" times a second, all from one thread. The first second is
+    // left out, then each child's frame rate is taken over "seconds"
+    bool RunChildren(size_t children, size_t frameSize, double fps, double seconds)
+    {
+      ParentServer server;
+      if (!server.Start())
+        return false;
+
+      std::vector<std::unique_ptr<net::ClientInterface<MessageType>>> clients;
+      for (size_t i = 0; i < children; i++)
+      {
+        std::unique_ptr<net::ClientInterface<MessageType>> client = std::make_unique<net::ClientInterface<MessageType>>();
+        client->SetSuperseding(MessageType::client_frame_pixels_update);
+        client->SetSessionMode(true);
+        client->SetDatagramType(MessageType::client_frame_pixels_update);
+        client->SetSharedMemoryTransport(false);
+        client->Connect("127.0.0.1", bench::BenchPort);
+        clients.push_back(std::move(client));
+      }
+
+      // Each session's second connection joins its first, the datagram senders are up by then
+      if (!bench::WaitUntil([&]() { return server.accepted == 2 * children && server.GetClientCount() == children; }, std::chrono::seconds(10)))
+      {
+        std::printf("%8zu could not connect\n", children);
+        return false;
+      }
+
+      std::atomic<bool> bRunning = true;
+      std::thread sender([&]()
+        {
+          auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+          auto next = std::chrono::steady_clock::now();
+          while (bRunning)
+          {
+            for (std::unique_ptr<net::ClientInterface<MessageType>>& client : clients)
+            {
+              net::message<MessageType> frame;
+              frame.header.id = MessageType::client_frame_pixels_update;
+              frame.body.resize(frameSize);
+              frame.header.size = static_cast<uint32_t>(frame.body.size());
+              client->Send(std::move(frame));
+            }
+            next += interval;
+            std::this_thread::sleep_until(next);
+          }
+        });
+
+      auto start = std::chrono::steady_clock::now();
+      while (bench::MillisecondsSince(start) < 1000.0)
+        if (server.Update() == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+      std::map<uint32_t, size_t> framesBefore = server.frames;
+      bench::CPUTime cpuBefore = bench::GetCPUTime();
+      start = std::chrono::steady_clock::now();
+      while (bench::MillisecondsSince(start) < seconds * 1000.0)
+        if (server.Update() == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+      double elapsed = bench::MillisecondsSince(start) / 1000.0;
+      bench::CPUTime cpu = bench::GetCPUTime();
+
+      bRunning = false;
+      sender.join();
+      for (std::unique_ptr<net::ClientInterface<MessageType>>& client : clients)
+        client->Disconnect();
+      server.Stop();
+
+      // A child whose frames never arrived still counts, at zero
+      std::vector<double> rates(children, 0.0);
+      size_t total = 0, next = 0;
+      for (auto& [id, count] : server.frames)
+      {
+        size_t received = count - framesBefore[id];
+        total += received;
+        if (next < children)
+          rates[next++] = received / elapsed;
+      }
+      size_t holding = std::count_if(rates.begin(), rates.end(), [&](double rate) { return rate >= fps * 0.95; });
+
+      double cpuSeconds = cpu.Total() - cpuBefore.Total();
+      std::printf("%8zu %7.0f %9.1f %9.1f %9.1f %7zu/%-3zu %9.1f %7.0f%% %10.2f\n", children, fps, bench::Percentile(rates, 0.0), bench::Percentile(rates, 50.0),
+        bench::Percentile(rates, 100.0), holding, children, total * frameSize / elapsed / (1024.0 * 1024.0), 100.0 * cpuSeconds / elapsed,
+        1000.0 * cpuSeconds / std::max<size_t>(total, 1));
+      return total > 0;
+    }
+
+    // How many children one parent keeps at their frame rate. The children run in this
+    // same process, so the CPU is theirs and the parent's together
+    int ChildrenBench(const std::vector<std::string>& args)
+    {
+      double fps = bench::GetArg(args, 0, 30.0);
+      size_t frameSize = bench::GetArg(args, 1, uint64_t(100 * 1024));
+      double seconds = bench::GetArg(args, 2, 5.0);
+
+      std::printf("%8s %7s %9s %9s %9s %11s %9s %8s %10s\n", "children", "target", "min fps", "p50 fps", "max fps", "holding", "MB/s", "cpu", "cpu ms/frm");
+      bool bOk = true;
+      for (size_t children : { 1, 4, 12, 24 })
+        bOk &= RunChildren(children, frameSize, fps, seconds);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("children", "[fps] [frame bytes] [seconds] - per child frame rate and CPU with 1-24 children streaming to one parent", ChildrenBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <cstdio>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    // Which connection loop is compiled in, both can't be in one build
+#if defined(RPC_NET_COROUTINES)
+    const char* LoopName = "coroutines";
+#else
+    const char* LoopName = "callbacks";
+#endif
+
+    // Counts what arrives
+    class LoopServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      LoopServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      std::atomic<uint64_t> received = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        received++;
+      }
+    };
+
+    // One client streams "count" messages of "size" bytes at one server. The first
+    // tenth warms the pools and queues up and is left out of the counts
+    bool RunConnectionLoop(uint64_t count, size_t size)
+    {
+      LoopServer server;
+      if (!server.Start())
+        return false;
+
+      net::ClientInterface<MessageType> client;
+      client.Connect("127.0.0.1", bench::BenchPort);
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+        return false;
+
+      std::thread sender([&]()
+        {
+          for (uint64_t i = 0; i < count; i++)
+          {
+            // Kept a few messages deep, a queue growing without end allocates too
+            while (client.GetQueuedBytes() > 256 * 1024)
+              std::this_thread::yield();
+
+            net::message<MessageType> msg;
+            msg.header.id = MessageType::client_input_update;
+            msg.body.resize(size);
+            msg.header.size = static_cast<uint32_t>(size);
+            net::shared_message<MessageType> shared(std::move(msg));
+            while (!client.Send(shared))
+              std::this_thread::yield();
+          }
+        });
+
+      uint64_t warmup = count / 10;
+      while (server.received < warmup)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+
+      uint64_t allocationsBefore = bench::GetAllocationCount();
+      uint64_t receivedBefore = server.received;
+      auto start = std::chrono::steady_clock::now();
+      while (server.received < count && bench::MillisecondsSince(start) < 60000.0)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+      double seconds = bench::MillisecondsSince(start) / 1000.0;
+      uint64_t allocations = bench::GetAllocationCount() - allocationsBefore;
+      uint64_t received = server.received - receivedBefore;
+      sender.join();
+
+      client.Disconnect();
+      server.Stop();
+
+      std::printf("%-10s %8zu %10llu %12.0f %12.2f\n", LoopName, size, static_cast<unsigned long long>(received), received / seconds,
+        static_cast<double>(allocations) / std::max<uint64_t>(received, 1));
+      return server.received == count;
+    }
+
+    // Messages per second and heap allocations per message of the connection loop the
+    // build has, callbacks or coroutines (premake --net-coroutines). The message bodies
+    // themselves cost one allocation to make and none to receive, the rest is the loop's
+    int ConnectionLoopBench(const std::vector<std::string>& args)
+    {
+      uint64_t count = bench::GetArg(args, 0, uint64_t(200000));
+
+      std::printf("%-10s %8s %10s %12s %12s\n", "loop", "size", "messages", "msg/s", "allocs/msg");
+      bool bOk = true;
+      for (size_t size : { 0, 64, 1024, 16 * 1024 })
+        bOk &= RunConnectionLoop(count, size);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("loop", "[count] - messages/sec and allocations per message of the callback or coroutine connection loop", ConnectionLoopBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include <atomic>
+#include <cstdio>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+    using Clock = std::chrono::steady_clock;
+
+    int64_t NowNs()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Frames are counted, input messages carry the time they were sent and are timed.
+    // Everything is handled on the main thread, from Update
+    class LatencyServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      LatencyServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      std::vector<double> latencies;
+      uint64_t frameBytes = 0;
+      std::atomic<size_t> accepted = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        accepted++;
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        if (msg.header.id == MessageType::client_input_update)
+        {
+          int64_t sent = 0;
+          msg >> sent;
+          latencies.push_back((NowNs() - sent) / 1e6);
+        }
+        else
+          frameBytes += msg.body.size();
+      }
+    };
+
+    // How the control messages travel next to the frames
+    enum class Lane
+    {
+      // On the same stream, queued like a frame, the way everything went at first
+      Shared,
+      // On the same stream, but skipping the frames still queued
+      Priority,
+      // On a connection of their own, session mode
+      Session
+    };
+
+    // A child saturates the link with 2 MB frames while it sends an input message
+    // every 5ms, the server times how long each takes to arrive
+    bool RunControlLatency(Lane lane, size_t controls)
+    {
+      const char* names[] = { "shared", "priority", "session" };
+      const char* name = names[static_cast<int>(lane)];
+
+      LatencyServer server;
+      if (!server.Start())
+        return false;
+
+      // In session mode the second connection joins the first, the server still
+      // presents a single client
+      net::ClientInterface<MessageType> client;
+      client.SetSessionMode(lane == Lane::Session);
+      client.Connect("127.0.0.1", bench::BenchPort);
+      size_t connections = lane == Lane::Session ? 2 : 1;
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.accepted == connections && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+      {
+        std::printf("%-9s could not connect\n", name);
+        return false;
+      }
+
+      std::atomic<bool> bRunning = true;
+      std::thread frames([&]()
+        {
+          // 32 MB queued, far more than the socket buffers hold
+          while (bRunning)
+          {
+            if (client.GetQueuedBytes() < 32 * 1024 * 1024)
+            {
+              net::message<MessageType> frame;
+              frame.header.id = MessageType::client_frame_pixels_update;
+              frame.body.resize(2 * 1024 * 1024);
+              frame.header.size = static_cast<uint32_t>(frame.body.size());
+              client.Send(std::move(frame));
+            }
+            else
+              std::this_thread::sleep_for(std::chrono::microseconds(200));
+          }
+        });
+
+      std::thread inputs([&]()
+        {
+          for (size_t i = 0; i < controls && bRunning; i++)
+          {
+            net::message<MessageType> input;
+            input.header.id = MessageType::client_input_update;
+            input << NowNs();
+            client.Send(std::move(input), lane == Lane::Shared ? net::message_priority::bulk : net::message_priority::control);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          }
+        });
+
+      auto start = std::chrono::steady_clock::now();
+      while (server.latencies.size() < controls && bench::MillisecondsSince(start) < 30000.0)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+      double seconds = bench::MillisecondsSince(start) / 1000.0;
+
+      bRunning = false;
+      inputs.join();
+      frames.join();
+      client.Disconnect();
+      server.Stop();
+
+      size_t received = server.latencies.size();
+      double p50 = bench::Percentile(server.latencies, 50.0);
+      double p99 = bench::Percentile(server.latencies, 99.0);
+      double max = bench::Percentile(server.latencies, 100.0);
+      std::printf("%-9s %8zu %9.2f %9.2f %9.2f %10.1f\n", name, received, p50, p99, max, server.frameBytes / seconds / (1024.0 * 1024.0));
+      return received == controls;
+    }
+
+    // Head-of-line blocking of control messages behind a saturated frame stream
+    int ControlLatencyBench(const std::vector<std::string>& args)
+    {
+      size_t controls = bench::GetArg(args, 0, uint64_t(400));
+
+      std::printf("%-9s %8s %9s %9s %9s %10s\n", "lane", "controls", "p50 ms", "p99 ms", "max ms", "frame MB/s");
+      bool bOk = true;
+      for (Lane lane : { Lane::Shared, Lane::Priority, Lane::Session })
+        bOk &= RunControlLatency(lane, controls);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("control", "[count] - control message latency under a saturated frame stream, with and without session mode", ControlLatencyBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    int64_t NowNs()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Frames start with the time they were sent, the rest is a pattern checked on arrival
+    uint8_t Pattern(size_t i)
+    {
+      return static_cast<uint8_t>(i * 7);
+    }
+
+    class FrameServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      FrameServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+        SetDatagramTransport(true);
+      }
+
+      std::vector<double> latencies;
+      size_t corrupt = 0;
+      std::atomic<size_t> accepted = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        accepted++;
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        if (msg.header.id != MessageType::client_frame_pixels_update || msg.body.size() < sizeof(int64_t))
+          return;
+
+        int64_t sent = 0;
+        std::memcpy(&sent, msg.body.data(), sizeof(sent));
+        latencies.push_back((NowNs() - sent) / 1e6);
+
+        for (size_t i = sizeof(sent); i < msg.body.size(); i++)
+          if (msg.body[i] != Pattern(i))
+          {
+            corrupt++;
+            break;
+          }
+      }
+    };
+
+    // A child sends "frames" frames of about 150 KB as datagrams, one every 10ms, while
+    // "lossRate" of its datagrams are dropped on purpose before they leave. With a
+    // "groupSize" a parity datagram follows every that many, zero sends none
+    bool RunDatagramLoss(size_t frames, double lossRate, size_t groupSize)
+    {
+      FrameServer server;
+      if (!server.Start())
+        return false;
+
+      net::ClientInterface<MessageType> client;
+      client.SetSessionMode(true);
+      client.SetSharedMemoryTransport(false);
+      client.SetDatagramType(MessageType::client_frame_pixels_update, groupSize);
+      client.SetDatagramLossRate(lossRate);
+      client.Connect("127.0.0.1", bench::BenchPort);
+
+      // The datagram sender is up once the session's second connection has joined
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.accepted == 2 && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+      {
+        std::printf("could not set up a session\n");
+        return false;
+      }
+
+      std::atomic<bool> bSent = false;
+      std::thread sender([&]()
+        {
+          for (size_t f = 0; f < frames; f++)
+          {
+            net::message<MessageType> frame;
+            frame.header.id = MessageType::client_frame_pixels_update;
+            frame.body.resize(150 * 1024 + f);
+            for (size_t i = sizeof(int64_t); i < frame.body.size(); i++)
+              frame.body[i] = Pattern(i);
+            int64_t now = NowNs();
+            std::memcpy(frame.body.data(), &now, sizeof(now));
+            frame.header.size = static_cast<uint32_t>(frame.body.size());
+            client.Send(std::move(frame));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+          bSent = true;
+        });
+
+      // Whatever is still missing a little after the last frame has been lost
+      auto sentAt = std::chrono::steady_clock::time_point::max();
+      while (server.latencies.size() < frames)
+      {
+        if (bSent && sentAt == std::chrono::steady_clock::time_point::max())
+          sentAt = std::chrono::steady_clock::now();
+        if (sentAt != std::chrono::steady_clock::time_point::max() && bench::MillisecondsSince(sentAt) > 200.0)
+          break;
+        if (server.Update() == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      sender.join();
+
+      net::datagram_stats stats = server.GetDatagramStats();
+      client.Disconnect();
+      server.Stop();
+
+      size_t completed = server.latencies.size();
+      double p50 = bench::Percentile(server.latencies, 50.0);
+      double p99 = bench::Percentile(server.latencies, 99.0);
+      std::printf("%5.1f%% %6zu %8zu/%-6zu %7.1f%% %9llu %9.2f %9.2f %8zu\n", lossRate * 100.0, groupSize, completed, frames, 100.0 * completed / frames,
+        static_cast<unsigned long long>(stats.recovered), p50, p99, server.corrupt);
+      return server.corrupt == 0;
+    }
+
+    // Frame completion and latency of the datagram transport over loopback, with losses
+    // injected at the sender, with and without XOR parity
+    int DatagramLossBench(const std::vector<std::string>& args)
+    {
+      size_t frames = bench::GetArg(args, 0, uint64_t(200));
+      size_t groupSize = bench::GetArg(args, 1, uint64_t(8));
+
+      std::printf("%6s %6s %15s %8s %9s %9s %9s %8s\n", "loss", "group", "frames", "complete", "recovered", "p50 ms", "p99 ms", "corrupt");
+      bool bOk = true;
+      for (double lossRate : { 0.0, 0.01, 0.02, 0.05, 0.10 })
+        for (size_t group : { size_t(0), groupSize })
+          bOk &= RunDatagramLoss(frames, lossRate, group);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("datagram", "[frames] [group] - frame completion and latency of the datagram transport at 0-10% injected loss", DatagramLossBench);
+  }
+}
\ No newline at end of file
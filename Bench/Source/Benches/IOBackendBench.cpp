@@ -0,0 +1,135 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    int64_t NowNs()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Counts what arrives and times it, messages start with the time they were sent
+    class BackendServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      BackendServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      uint64_t received = 0;
+      uint64_t bytes = 0;
+      std::vector<double> latencies;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        received++;
+        bytes += msg.body.size();
+
+        int64_t sent = 0;
+        std::memcpy(&sent, msg.body.data(), sizeof(sent));
+        latencies.push_back((NowNs() - sent) / 1e6);
+      }
+    };
+
+    // "connections" clients stream messages of "size" bytes at one server for "seconds",
+    // each kept at most 64 KB behind so the latency is the transport's and not a queue's
+    bool RunBackend(size_t connections, size_t size, double seconds)
+    {
+      BackendServer server;
+      if (!server.Start())
+        return false;
+
+      std::vector<std::unique_ptr<net::ClientInterface<MessageType>>> clients;
+      for (size_t i = 0; i < connections; i++)
+      {
+        clients.push_back(std::make_unique<net::ClientInterface<MessageType>>());
+        clients.back()->Connect("127.0.0.1", bench::BenchPort);
+      }
+      if (!bench::WaitUntil([&]() { return server.GetClientCount() == connections; }, std::chrono::seconds(10)))
+      {
+        std::printf("%11zu could not connect\n", connections);
+        return false;
+      }
+
+      bench::CPUTime cpuBefore = bench::GetCPUTime();
+      auto start = std::chrono::steady_clock::now();
+
+      std::atomic<bool> bRunning = true;
+      std::thread sender([&]()
+        {
+          while (bRunning)
+          {
+            bool bSent = false;
+            for (std::unique_ptr<net::ClientInterface<MessageType>>& client : clients)
+              if (client->GetQueuedBytes() < 64 * 1024)
+              {
+                net::message<MessageType> msg;
+                msg.header.id = MessageType::client_input_update;
+                msg.body.resize(size);
+                int64_t now = NowNs();
+                std::memcpy(msg.body.data(), &now, sizeof(now));
+                msg.header.size = static_cast<uint32_t>(size);
+                client->Send(std::move(msg));
+                bSent = true;
+              }
+            if (!bSent)
+              std::this_thread::yield();
+          }
+        });
+
+      while (bench::MillisecondsSince(start) < seconds * 1000.0)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+
+      double elapsed = bench::MillisecondsSince(start) / 1000.0;
+      bench::CPUTime cpu = bench::GetCPUTime();
+      bRunning = false;
+      sender.join();
+
+      for (std::unique_ptr<net::ClientInterface<MessageType>>& client : clients)
+        client->Disconnect();
+      server.Stop();
+
+      double gigabytes = server.bytes / (1024.0 * 1024.0 * 1024.0);
+      std::printf("%11zu %8zu %12.0f %9.1f %12.2f %9.2f %9.2f\n", connections, size, server.received / elapsed, server.bytes / elapsed / (1024.0 * 1024.0),
+        (cpu.Total() - cpuBefore.Total()) / std::max(gigabytes, 1e-9), bench::Percentile(server.latencies, 50.0), bench::Percentile(server.latencies, 99.0));
+      return server.received > 0;
+    }
+
+    // Throughput, CPU and latency of whichever socket backend asio was built with, over
+    // 1, 16 and 128 connections. Build once with premake --io-uring and once without
+    // (Scripts/BuildBenchLinux.sh does both) and compare the two
+    int IOBackendBench(const std::vector<std::string>& args)
+    {
+      size_t size = bench::GetArg(args, 0, uint64_t(1024));
+      double seconds = bench::GetArg(args, 1, 3.0);
+      size = std::max(size, sizeof(int64_t));
+
+      std::printf("Socket I/O on %s\n", net::GetIOBackendName());
+      std::printf("%11s %8s %12s %9s %12s %9s %9s\n", "connections", "size", "msg/s", "MB/s", "cpu s/GB", "p50 ms", "p99 ms");
+      bool bOk = true;
+      for (size_t connections : { 1, 16, 128 })
+        bOk &= RunBackend(connections, size, seconds);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("iobackend", "[size] [seconds] - messages/sec, CPU per GB and p99 latency of the socket backend over 1-128 connections", IOBackendBench);
+  }
+}
\ No newline at end of file
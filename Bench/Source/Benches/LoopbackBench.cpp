@@ -0,0 +1,121 @@
+#include <atomic>
+#include <cstdio>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+    using ReadMode = net::connection<MessageType>::read_mode;
+
+    // Counts what arrives
+    class LoopbackServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      LoopbackServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      std::atomic<uint64_t> received = 0;
+      std::atomic<uint64_t> bytes = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        received++;
+        bytes += msg.body.size();
+      }
+    };
+
+    // One client streams "count" messages of "size" bytes at one server as fast as it
+    // can, from a thread of its own, while the main thread handles them on arrival
+    bool RunLoopback(uint64_t count, size_t size, ReadMode mode)
+    {
+      LoopbackServer server;
+      server.SetReadMode(mode);
+      if (!server.Start())
+        return false;
+
+      net::ClientInterface<MessageType> client;
+      client.Connect("127.0.0.1", bench::BenchPort);
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+        return false;
+
+      bench::SyscallCount syscallsBefore = bench::GetSyscallCount();
+      bench::CPUTime cpuBefore = bench::GetCPUTime();
+      auto start = std::chrono::steady_clock::now();
+
+      std::thread sender([&]()
+        {
+          for (uint64_t i = 0; i < count; i++)
+          {
+            net::message<MessageType> msg;
+            msg.header.id = MessageType::client_input_update;
+            msg.body.resize(size);
+            msg.header.size = static_cast<uint32_t>(size);
+            // The outgoing queue is bounded, a message it has no room for is sent again
+            net::shared_message<MessageType> shared(std::move(msg));
+            while (!client.Send(shared))
+              std::this_thread::yield();
+          }
+        });
+
+      while (server.received < count && bench::MillisecondsSince(start) < 60000.0)
+        if (server.Update() == 0)
+          std::this_thread::yield();
+      sender.join();
+
+      double seconds = bench::MillisecondsSince(start) / 1000.0;
+      bench::CPUTime cpu = bench::GetCPUTime();
+      bench::SyscallCount syscalls = bench::GetSyscallCount();
+      uint64_t received = server.received;
+
+      client.Disconnect();
+      server.Stop();
+
+      double perMessage = 1.0 / std::max<uint64_t>(received, 1);
+      std::printf("%-8s %8zu %10llu %12.0f %9.1f %8.3f %8.3f %8.3f %9.2f\n",
+        mode == ReadMode::buffered ? "buffered" : "exact", size, static_cast<unsigned long long>(received), received / seconds, server.bytes / seconds / (1024.0 * 1024.0),
+        (syscalls.sends - syscallsBefore.sends) * perMessage,
+        (syscalls.receives - syscallsBefore.receives) * perMessage,
+        (syscalls.waits - syscallsBefore.waits) * perMessage,
+        (cpu.Total() - cpuBefore.Total()) * 1e6 * perMessage);
+      return received == count;
+    }
+
+    // Messages per second over loopback and the syscalls each one costs, for a range of
+    // sizes and both ways of reading. The fewer sends per message, the more the writes
+    // are being coalesced, the fewer receives, the more each read takes in
+    int LoopbackBench(const std::vector<std::string>& args)
+    {
+      uint64_t count = bench::GetArg(args, 0, uint64_t(200000));
+
+      if (!bench::CanCountSyscalls())
+        std::printf("Syscalls are only counted on Linux, they show as zero\n");
+      std::printf("%-8s %8s %10s %12s %9s %8s %8s %8s %9s\n", "reads", "size", "messages", "msg/s", "MB/s", "send/msg", "recv/msg", "wait/msg", "cpu us/msg");
+
+      bool bOk = true;
+      for (ReadMode mode : { ReadMode::exact, ReadMode::buffered })
+        for (size_t size : { 0, 64, 1024, 16 * 1024, 256 * 1024 })
+        {
+          // Large messages are capped at 1 GB a run
+          uint64_t sizeCount = size > 0 ? std::min<uint64_t>(count, (uint64_t(1) << 30) / size) : count;
+          bOk &= RunLoopback(sizeCount, size, mode);
+        }
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("loopback", "[count] - messages/sec and syscalls per message over one TCP connection", LoopbackBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <deque>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    int64_t NowNs(std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now())
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // A home router's uplink: a TCP proxy that lets bytes from the client through at
+    // "rate" bytes per second, queueing as many as arrive in the meantime. The way
+    // back is not shaped. Everything runs on one thread
+    class LinkShaper
+    {
+    public:
+      LinkShaper(uint16_t listenPort, uint16_t serverPort, size_t rate)
+        : m_Acceptor(m_Context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), listenPort)),
+          m_Client(m_Context), m_Server(m_Context), m_Tick(m_Context), m_ServerPort(serverPort), m_Rate(rate)
+      {
+        m_Acceptor.async_accept(m_Client,
+          [this](const asio::error_code& ec)
+          {
+            if (ec)
+              return;
+
+            m_Client.set_option(asio::ip::tcp::no_delay(true));
+            m_Server.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), m_ServerPort));
+            m_Server.set_option(asio::ip::tcp::no_delay(true));
+            ReadClient();
+            ReadServer();
+            m_LastTick = std::chrono::steady_clock::now();
+            Tick();
+          });
+        m_Thread = std::thread([this]() { m_Context.run(); });
+      }
+
+      ~LinkShaper()
+      {
+        asio::post(m_Context,
+          [this]()
+          {
+            asio::error_code ec;
+            m_Acceptor.close(ec);
+            m_Client.close(ec);
+            m_Server.close(ec);
+            m_Tick.cancel();
+          });
+        m_Thread.join();
+      }
+
+      // Most bytes ever held back at once
+      size_t GetPeakQueue() const
+      {
+        return m_PeakQueue;
+      }
+
+    private:
+      void ReadClient()
+      {
+        m_Client.async_read_some(asio::buffer(m_ClientBuffer),
+          [this](const asio::error_code& ec, size_t length)
+          {
+            if (ec)
+              return;
+
+            m_Queue.insert(m_Queue.end(), m_ClientBuffer.begin(), m_ClientBuffer.begin() + length);
+            m_PeakQueue = std::max<size_t>(m_PeakQueue, m_Queue.size());
+            ReadClient();
+          });
+      }
+
+      void ReadServer()
+      {
+        m_Server.async_read_some(asio::buffer(m_ServerBuffer),
+          [this](const asio::error_code& ec, size_t length)
+          {
+            if (ec)
+              return;
+
+            asio::error_code ignored;
+            asio::write(m_Client, asio::buffer(m_ServerBuffer.data(), length), ignored);
+            ReadServer();
+          });
+      }
+
+      // Every millisecond the link earns its rate's worth of bytes, up to 5ms of it
+      void Tick()
+      {
+        m_Tick.expires_after(std::chrono::milliseconds(1));
+        m_Tick.async_wait(
+          [this](const asio::error_code& ec)
+          {
+            if (ec)
+              return;
+
+            auto now = std::chrono::steady_clock::now();
+            m_Allowance = std::min(m_Allowance + std::chrono::duration<double>(now - m_LastTick).count() * m_Rate, m_Rate * 0.005);
+            m_LastTick = now;
+
+            size_t length = std::min(static_cast<size_t>(m_Allowance), m_Queue.size());
+            if (length > 0)
+            {
+              m_Out.assign(m_Queue.begin(), m_Queue.begin() + length);
+              m_Queue.erase(m_Queue.begin(), m_Queue.begin() + length);
+              m_Allowance -= length;
+
+              asio::error_code ignored;
+              asio::write(m_Server, asio::buffer(m_Out), ignored);
+            }
+            Tick();
+          });
+      }
+
+    private:
+      asio::io_context m_Context;
+      asio::ip::tcp::acceptor m_Acceptor;
+      asio::ip::tcp::socket m_Client;
+      asio::ip::tcp::socket m_Server;
+      asio::steady_timer m_Tick;
+      uint16_t m_ServerPort;
+      double m_Rate;
+
+      std::array<uint8_t, 64 * 1024> m_ClientBuffer;
+      std::array<uint8_t, 64 * 1024> m_ServerBuffer;
+      std::deque<uint8_t> m_Queue;
+      std::vector<uint8_t> m_Out;
+      std::atomic<size_t> m_PeakQueue = 0;
+      double m_Allowance = 0.0;
+      std::chrono::steady_clock::time_point m_LastTick;
+      std::thread m_Thread;
+    };
+
+    // Echoes pings straight back, counts frames
+    class EchoServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      EchoServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      size_t frames = 0;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        if (msg.header.id == MessageType::server_ping)
+          MessageClient(client, msg, net::message_priority::control);
+        else
+          frames++;
+      }
+    };
+
+    // A child sends a 100 KB frame every 50ms through a shaped uplink, and a ping every
+    // 10ms that the server echoes. The round trip of the pings is what everything else
+    // on that link would see too
+    bool RunPacing(size_t linkRate, size_t pacingRate, double seconds)
+    {
+      EchoServer server;
+      if (!server.Start())
+        return false;
+
+      uint16_t shaperPort = bench::BenchPort + 1;
+      LinkShaper shaper(shaperPort, bench::BenchPort, linkRate);
+
+      net::ClientInterface<MessageType> client;
+      client.SetPacingRate(pacingRate);
+      client.Connect("127.0.0.1", shaperPort);
+      if (!bench::WaitUntil([&]() { return client.IsConnected() && server.GetClientCount() == 1; }, std::chrono::seconds(5)))
+      {
+        std::printf("could not connect through the shaper\n");
+        return false;
+      }
+
+      std::atomic<bool> bRunning = true;
+      std::thread frames([&]()
+        {
+          while (bRunning)
+          {
+            net::message<MessageType> frame;
+            frame.header.id = MessageType::client_frame_pixels_update;
+            frame.body.resize(100 * 1000);
+            frame.header.size = static_cast<uint32_t>(frame.body.size());
+            client.Send(std::move(frame));
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          }
+        });
+
+      // The first second fills the queues, it is left out
+      std::vector<double> rtts;
+      std::vector<net::owned_message<MessageType>> incoming;
+      auto start = std::chrono::steady_clock::now();
+      auto nextPing = start;
+      while (bench::MillisecondsSince(start) < seconds * 1000.0)
+      {
+        if (std::chrono::steady_clock::now() >= nextPing)
+        {
+          net::message<MessageType> ping;
+          ping.header.id = MessageType::server_ping;
+          ping << NowNs();
+          client.Send(std::move(ping), net::message_priority::control);
+          nextPing += std::chrono::milliseconds(10);
+        }
+
+        server.Update();
+
+        client.Incoming().drain(incoming);
+        for (net::owned_message<MessageType>& echo : incoming)
+        {
+          int64_t sent = 0;
+          echo.msg >> sent;
+          if (bench::MillisecondsSince(start) > 1000.0)
+            rtts.push_back((NowNs(echo.received) - sent) / 1e6);
+        }
+        incoming.clear();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+
+      bRunning = false;
+      frames.join();
+      client.Disconnect();
+      server.Stop();
+
+      double p50 = bench::Percentile(rtts, 50.0);
+      double p99 = bench::Percentile(rtts, 99.0);
+      double max = bench::Percentile(rtts, 100.0);
+      std::printf("%9.2f %9.2f %7zu %6zu %9.1f %9.1f %9.1f %12zu\n", linkRate / 1e6, pacingRate / 1e6, server.frames, rtts.size(), p50, p99, max, shaper.GetPeakQueue() / 1024);
+      return !rtts.empty();
+    }
+
+    // Round trip under load through a shaped uplink, with pacing off and at a share of
+    // the link's rate
+    int PacingBench(const std::vector<std::string>& args)
+    {
+      size_t linkRate = bench::GetArg(args, 0, uint64_t(2500000));
+      double seconds = bench::GetArg(args, 1, 6.0);
+
+      std::printf("%9s %9s %7s %6s %9s %9s %9s %12s\n", "link MB/s", "pace MB/s", "frames", "pings", "p50 ms", "p99 ms", "max ms", "peak queue KB");
+      bool bOk = true;
+      for (double share : { 0.0, 0.95, 0.9 })
+        bOk &= RunPacing(linkRate, static_cast<size_t>(linkRate * share), seconds);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("pacing", "[link bytes/s] [seconds] - ping round trip through a shaped uplink under frame load, with and without pacing", PacingBench);
+  }
+}
\ No newline at end of file
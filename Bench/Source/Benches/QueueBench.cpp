@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <thread>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    // What the network layer queues, with the producer and its sequence number tucked
+    // into the header so the consumer can check each producer's order
+    using Item = net::owned_message<net::message_type>;
+
+    // The ring is bounded, a producer that finds it full waits for the consumer
+    void Push(mpsc_queue<Item>& queue, Item&& item)
+    {
+      while (!queue.try_push(std::move(item)))
+        std::this_thread::yield();
+    }
+
+    void Push(tsdeque<Item>& queue, Item&& item)
+    {
+      queue.push_back(std::move(item));
+    }
+
+    bool Pop(mpsc_queue<Item>& queue, Item& item)
+    {
+      return queue.try_pop(item);
+    }
+
+    // A single consumer may check and then pop
+    bool Pop(tsdeque<Item>& queue, Item& item)
+    {
+      if (queue.empty())
+        return false;
+      item = queue.pop_front();
+      return true;
+    }
+
+    // "producers" threads push "count" items each while this thread pops them. The
+    // consumer polls rather than waits, tsdeque::wait can miss the last wakeup
+    template<typename Queue>
+    bool RunQueue(const char* name, size_t producers, uint64_t count)
+    {
+      Queue queue;
+      std::vector<uint32_t> next(producers, 0);
+      bool bOrdered = true;
+
+      bench::CPUTime cpuBefore = bench::GetCPUTime();
+      auto start = std::chrono::steady_clock::now();
+
+      std::vector<std::thread> threads;
+      for (size_t p = 0; p < producers; p++)
+        threads.emplace_back([&queue, p, count]()
+          {
+            for (uint64_t i = 0; i < count; i++)
+            {
+              Item item;
+              item.msg.header.id = static_cast<net::message_type>(p);
+              item.msg.header.size = static_cast<uint32_t>(i);
+              Push(queue, std::move(item));
+            }
+          });
+
+      uint64_t total = producers * count;
+      for (uint64_t popped = 0; popped < total;)
+      {
+        Item item;
+        if (!Pop(queue, item))
+        {
+          std::this_thread::yield();
+          continue;
+        }
+
+        size_t p = static_cast<size_t>(item.msg.header.id);
+        bOrdered &= item.msg.header.size == next[p]++;
+        popped++;
+      }
+
+      for (std::thread& thread : threads)
+        thread.join();
+
+      double seconds = bench::MillisecondsSince(start) / 1000.0;
+      double cpu = bench::GetCPUTime().Total() - cpuBefore.Total();
+      std::printf("%9zu %-10s %10.2f %12.1f %8s\n", producers, name, total / seconds / 1e6, cpu * 1e9 / total, bOrdered ? "yes" : "NO");
+      return bOrdered;
+    }
+
+    // The lock-free queue against the tsdeque it replaced, on the message type both carry
+    int QueueBench(const std::vector<std::string>& args)
+    {
+      uint64_t count = bench::GetArg(args, 0, uint64_t(1000000));
+
+      std::printf("%9s %-10s %10s %12s %8s\n", "producers", "queue", "Mitems/s", "cpu ns/item", "ordered");
+      bool bOk = true;
+      for (size_t producers : { 1, 4, 16 })
+      {
+        // Shared out, so every row moves as many items
+        uint64_t perProducer = count / producers;
+        bOk &= RunQueue<tsdeque<Item>>("tsdeque", producers, perProducer);
+        bOk &= RunQueue<mpsc_queue<Item>>("mpsc_queue", producers, perProducer);
+      }
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("queue", "[count] - mpsc_queue against tsdeque with 1, 4 and 16 producers", QueueBench);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    // Drops its client from this side and times how long the client takes to get a
+    // frame through again. Everything runs on the main thread, from Update
+    class ReconnectServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      ReconnectServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      // Closes the connection the last frame came in on
+      void Drop()
+      {
+        if (!m_Latest)
+          return;
+
+        m_DroppedID = m_Latest->GetID();
+        m_DroppedAt = std::chrono::steady_clock::now();
+        m_bDropped = true;
+        m_Latest->Disconnect();
+      }
+
+      bool IsDropped() const
+      {
+        return m_bDropped;
+      }
+
+      size_t frames = 0;
+      // From the drop to the first frame on another connection
+      std::vector<double> gaps;
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        return true;
+      }
+
+      void OnMessage(std::shared_ptr<net::connection<MessageType>> client, net::message<MessageType>& msg) override
+      {
+        if (msg.header.id != MessageType::client_frame_pixels_update)
+          return;
+
+        frames++;
+        m_Latest = client;
+        if (m_bDropped && client->GetID() != m_DroppedID)
+        {
+          gaps.push_back(bench::MillisecondsSince(m_DroppedAt));
+          m_bDropped = false;
+        }
+      }
+
+    private:
+      std::shared_ptr<net::connection<MessageType>> m_Latest;
+      uint32_t m_DroppedID = 0;
+      std::chrono::steady_clock::time_point m_DroppedAt;
+      bool m_bDropped = false;
+    };
+
+    net::message<MessageType> MakeFrame()
+    {
+      net::message<MessageType> frame;
+      frame.header.id = MessageType::client_frame_pixels_update;
+      frame.body.resize(100 * 1024);
+      frame.header.size = static_cast<uint32_t>(frame.body.size());
+      return frame;
+    }
+
+    // A child set up like ChildNetClient captures every "interval" and reconnects with
+    // jittered backoff when it loses the server, sending its last frame again right
+    // away, the way the child does. The server drops it "blips" times
+    bool RunReconnect(size_t blips, std::chrono::milliseconds interval)
+    {
+      ReconnectServer server;
+      if (!server.Start())
+        return false;
+
+      std::atomic<bool> bRunning = true;
+      std::atomic<size_t> attempts = 0;
+      std::thread child([&]()
+        {
+          net::ClientInterface<MessageType> client;
+          client.SetSuperseding(MessageType::client_frame_pixels_update);
+          client.SetSessionMode(true);
+          client.SetSharedMemoryTransport(false);
+
+          net::reconnect_backoff backoff;
+          auto lastCapture = std::chrono::steady_clock::now() - interval;
+          client.Connect("127.0.0.1", bench::BenchPort);
+          while (bRunning)
+          {
+            if (client.IsConnected())
+            {
+              if (std::chrono::steady_clock::now() - lastCapture >= interval)
+              {
+                lastCapture = std::chrono::steady_clock::now();
+                client.Send(MakeFrame());
+              }
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+              continue;
+            }
+
+            std::this_thread::sleep_for(backoff.Next());
+            attempts++;
+            client.Connect("127.0.0.1", bench::BenchPort);
+            if (bench::WaitUntil([&]() { return client.IsConnected(); }, std::chrono::seconds(1)))
+            {
+              backoff.Reset();
+              client.Send(MakeFrame());
+            }
+          }
+          client.Disconnect();
+        });
+
+      auto pump = [&](const std::function<bool()>& condition, std::chrono::milliseconds timeout)
+        {
+          auto start = std::chrono::steady_clock::now();
+          while (!condition() && bench::MillisecondsSince(start) < timeout.count())
+            if (server.Update() == 0)
+              std::this_thread::sleep_for(std::chrono::microseconds(200));
+          return condition();
+        };
+
+      bool bOk = pump([&]() { return server.frames > 0; }, std::chrono::seconds(5));
+      size_t lost = 0;
+      for (size_t i = 0; bOk && i < blips; i++)
+      {
+        pump([]() { return false; }, std::chrono::milliseconds(300));
+        server.Drop();
+        if (!pump([&]() { return !server.IsDropped(); }, std::chrono::seconds(5)))
+          lost++;
+      }
+
+      bRunning = false;
+      child.join();
+      server.Stop();
+
+      std::printf("%11lld %6zu %9zu %9.1f %9.1f %9zu\n", static_cast<long long>(interval.count()), server.gaps.size(), attempts.load(),
+        bench::Percentile(server.gaps, 50.0), bench::Percentile(server.gaps, 100.0), lost);
+      return bOk && lost == 0;
+    }
+
+    // A child that loses the server again while its session is still being set up: it
+    // connects, and a random 0-3ms later, with the session open, token and join in
+    // flight, disconnects and connects again, "rounds" times. Disconnecting tears down
+    // the half-made session, a lane opened in the middle of that must not hang it
+    bool RunHandshake(size_t rounds)
+    {
+      // Set up like ParentClient, so every step of the session handshake is taken
+      ReconnectServer server;
+      server.SetDatagramTransport(true);
+      server.SetSharedMemoryTransport(true);
+      if (!server.Start())
+        return false;
+
+      std::atomic<bool> bRunning = true;
+      std::thread updater([&]()
+        {
+          while (bRunning)
+            if (server.Update() == 0)
+              std::this_thread::sleep_for(std::chrono::microseconds(200));
+        });
+
+      // Set up like ChildNetClient, the token then also opens a datagram sender and
+      // offers a shared memory ring. Two threads let it be handled while the reconnect
+      // is under way
+      net::ClientInterface<MessageType> client;
+      client.SetSuperseding(MessageType::client_frame_pixels_update);
+      client.SetSessionMode(true);
+      client.SetDatagramType(MessageType::client_frame_pixels_update);
+      client.SetThreadCount(2);
+
+      std::mt19937 random(std::random_device{}());
+      std::uniform_int_distribution<int> delay(0, 3000);
+      std::vector<double> times;
+      for (size_t i = 0; i < rounds; i++)
+      {
+        client.Connect("127.0.0.1", bench::BenchPort);
+        std::this_thread::sleep_for(std::chrono::microseconds(delay(random)));
+
+        // A disconnect that hangs never comes back, so it is reported from here
+        std::atomic<bool> bDone = false;
+        std::thread watchdog([&]()
+          {
+            if (!bench::WaitUntil([&]() { return bDone.load(); }, std::chrono::seconds(5)))
+            {
+              std::printf("%9zu hung disconnecting during the handshake\n", i);
+              std::fflush(stdout);
+              std::_Exit(1);
+            }
+          });
+
+        auto start = std::chrono::steady_clock::now();
+        client.Disconnect();
+        times.push_back(bench::MillisecondsSince(start));
+        bDone = true;
+        watchdog.join();
+      }
+
+      // After all that a connect left to finish must still bring the session up
+      client.Connect("127.0.0.1", bench::BenchPort);
+      bool bConnected = bench::WaitUntil([&]() { return client.IsConnected(); }, std::chrono::seconds(2));
+      client.Disconnect();
+      bRunning = false;
+      updater.join();
+      server.Stop();
+
+      std::printf("%9zu %9.2f %9.2f %9s\n", rounds, bench::Percentile(times, 50.0), bench::Percentile(times, 100.0), bConnected ? "yes" : "no");
+      return bConnected;
+    }
+
+    // Time from losing the server to the next frame through, for a child that resends
+    // its last frame on reconnect. Without the resend it would be a backoff plus up to
+    // one capture interval
+    int ReconnectBench(const std::vector<std::string>& args)
+    {
+      size_t blips = bench::GetArg(args, 0, uint64_t(20));
+
+      std::printf("%11s %6s %9s %9s %9s %9s\n", "capture ms", "blips", "attempts", "p50 ms", "max ms", "no frame");
+      bool bOk = true;
+      for (int interval : { 200, 1000 })
+        bOk &= RunReconnect(blips, std::chrono::milliseconds(interval));
+
+      std::printf("\n%9s %9s %9s %9s\n", "handshake", "p50 ms", "max ms", "connected");
+      bOk &= RunHandshake(blips * 10);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("reconnect", "[blips] - time to the first frame after the server drops a child that reconnects with backoff, and reconnects during the handshake", ReconnectBench);
+  }
+}
\ No newline at end of file
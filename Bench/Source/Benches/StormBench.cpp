@@ -0,0 +1,147 @@
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+#include <rpc_core.h>
+#include <rpc_net.h>
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace
+  {
+    using MessageType = net::message_type;
+
+    // Notes when each client is let in, counted from the start of the storm
+    class StormServer : public net::ServerInterface<MessageType>
+    {
+    public:
+      StormServer()
+        : net::ServerInterface<MessageType>(bench::BenchPort)
+      {
+      }
+
+      void StartStorm()
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_StormStart = std::chrono::steady_clock::now();
+        m_AcceptTimes.clear();
+      }
+
+      size_t GetAccepted()
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_AcceptTimes.size();
+      }
+
+      std::vector<double> GetAcceptTimes()
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_AcceptTimes;
+      }
+
+    protected:
+      bool OnClientConnect(std::shared_ptr<net::connection<MessageType>> client) override
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_AcceptTimes.push_back(bench::MillisecondsSince(m_StormStart));
+        return true;
+      }
+
+    private:
+      std::mutex m_Mutex;
+      std::chrono::steady_clock::time_point m_StormStart;
+      std::vector<double> m_AcceptTimes;
+    };
+
+    // "clients" sockets connect at once, the way a lab of children does when the parent
+    // comes back. With "bTraffic" a connected child keeps streaming frames meanwhile,
+    // so the accepts have to get past its reads
+    bool RunStorm(size_t clients, size_t acceptors, bool bTraffic)
+    {
+      StormServer server;
+      server.SetAcceptorCount(acceptors);
+      if (!server.Start())
+        return false;
+
+      net::ClientInterface<MessageType> streamer;
+      std::atomic<bool> bStreaming = bTraffic;
+      std::thread traffic;
+      if (bTraffic)
+      {
+        streamer.Connect("127.0.0.1", bench::BenchPort);
+        if (!bench::WaitUntil([&]() { return streamer.IsConnected() && server.GetAccepted() == 1; }, std::chrono::seconds(5)))
+          return false;
+
+        traffic = std::thread([&]()
+          {
+            while (bStreaming)
+            {
+              // Frames of 256 KB, kept a few deep so the socket never runs dry
+              if (streamer.GetQueuedBytes() < 1024 * 1024)
+              {
+                net::message<MessageType> frame;
+                frame.header.id = MessageType::client_frame_pixels_update;
+                frame.body.resize(256 * 1024);
+                frame.header.size = static_cast<uint32_t>(frame.body.size());
+                streamer.Send(std::move(frame));
+              }
+              else
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+          });
+      }
+
+      // The storm itself, plain sockets on a context of their own, so nothing but the
+      // server's accepting is measured
+      asio::io_context context;
+      asio::ip::tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), bench::BenchPort);
+      std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+      server.StartStorm();
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < clients; i++)
+      {
+        sockets.push_back(std::make_unique<asio::ip::tcp::socket>(context));
+        sockets.back()->async_connect(endpoint, [](const asio::error_code&) {});
+      }
+      context.run();
+
+      // Frames are handled as they come, the way the parent would
+      bool bAccepted = false;
+      while (!(bAccepted = server.GetAccepted() >= clients) && bench::MillisecondsSince(start) < 30000.0)
+        if (server.Update() == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+      double total = bench::MillisecondsSince(start);
+
+      bStreaming = false;
+      if (traffic.joinable())
+        traffic.join();
+      sockets.clear();
+      streamer.Disconnect();
+      server.Stop();
+
+      std::vector<double> times = server.GetAcceptTimes();
+      std::printf("%9zu %-8s %8zu %10.1f %9.2f %9.2f\n", acceptors, bTraffic ? "frames" : "idle", times.size(), total,
+        bench::Percentile(times, 50.0), bench::Percentile(times, 99.0));
+      return bAccepted;
+    }
+
+    // How long a reconnect storm takes to be let in, with one acceptor and with several
+    // sharing the port, on an idle server and on one busy receiving frames
+    int StormBench(const std::vector<std::string>& args)
+    {
+      size_t clients = bench::GetArg(args, 0, uint64_t(500));
+      size_t acceptors = bench::GetArg(args, 1, uint64_t(std::max(4u, std::thread::hardware_concurrency())));
+
+      std::printf("%9s %-8s %8s %10s %9s %9s\n", "acceptors", "traffic", "accepted", "total ms", "p50 ms", "p99 ms");
+      bool bOk = true;
+      for (bool bTraffic : { false, true })
+        for (size_t count : { size_t(1), acceptors })
+          bOk &= RunStorm(clients, count, bTraffic);
+      return bOk ? 0 : 1;
+    }
+
+    const bench::BenchRegistration registration("storm", "[clients] [acceptors] - time for a reconnect storm of clients to be accepted", StormBench);
+  }
+}
\ No newline at end of file
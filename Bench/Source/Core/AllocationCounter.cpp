@@ -0,0 +1,125 @@
+// Counts every heap allocation the process makes, by replacing the global operator new.
+// The array and nothrow forms end up here too, so only the plain and aligned ones are
+// replaced, with the deletes that go with them
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "Core/Bench.h"
+
+namespace
+{
+  std::atomic<uint64_t> s_Allocations = 0;
+  thread_local uint64_t s_ThreadAllocations = 0;
+
+  void* Allocate(std::size_t size)
+  {
+    s_Allocations.fetch_add(1, std::memory_order_relaxed);
+    s_ThreadAllocations++;
+    if (void* pointer = std::malloc(size > 0 ? size : 1))
+      return pointer;
+    throw std::bad_alloc();
+  }
+
+  void* AllocateAligned(std::size_t size, std::align_val_t alignment)
+  {
+    s_Allocations.fetch_add(1, std::memory_order_relaxed);
+    s_ThreadAllocations++;
+    std::size_t align = static_cast<std::size_t>(alignment);
+#if defined(PLATFORM_WINDOWS)
+    void* pointer = _aligned_malloc(size > 0 ? size : 1, align);
+#else
+    void* pointer = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif
+    if (pointer)
+      return pointer;
+    throw std::bad_alloc();
+  }
+
+  void FreeAligned(void* pointer)
+  {
+#if defined(PLATFORM_WINDOWS)
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+  }
+}
+
+namespace rpc
+{
+  namespace bench
+  {
+    uint64_t GetAllocationCount()
+    {
+      return s_Allocations.load(std::memory_order_relaxed);
+    }
+
+    uint64_t GetThreadAllocationCount()
+    {
+      return s_ThreadAllocations;
+    }
+  }
+}
+
+void* operator new(std::size_t size)
+{
+  return Allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+  return Allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  return AllocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+  FreeAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+  FreeAligned(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept
+{
+  FreeAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept
+{
+  FreeAligned(pointer);
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <thread>
+
+#if defined(PLATFORM_WINDOWS)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Core/Bench.h"
+
+namespace rpc
+{
+  namespace bench
+  {
+    std::vector<Bench>& GetBenches()
+    {
+      static std::vector<Bench> benches;
+      return benches;
+    }
+
+    BenchRegistration::BenchRegistration(std::string name, std::string description, BenchFunction run)
+    {
+      GetBenches().push_back({ std::move(name), std::move(description), std::move(run) });
+    }
+
+    CPUTime GetCPUTime()
+    {
+      CPUTime time;
+#if defined(PLATFORM_WINDOWS)
+      FILETIME creation, exit, kernel, user;
+      if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+      {
+        // In units of 100ns
+        auto seconds = [](const FILETIME& t) { return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 1e7; };
+        time.user = seconds(user);
+        time.system = seconds(kernel);
+      }
+#else
+      rusage usage = {};
+      if (getrusage(RUSAGE_SELF, &usage) == 0)
+      {
+        time.user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+        time.system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+      }
+#endif
+      return time;
+    }
+
+    double Percentile(std::vector<double>& samples, double percentile)
+    {
+      if (samples.empty())
+        return 0.0;
+
+      std::sort(samples.begin(), samples.end());
+      size_t index = static_cast<size_t>(percentile / 100.0 * (samples.size() - 1) + 0.5);
+      return samples[std::min(index, samples.size() - 1)];
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t GetArg(const std::vector<std::string>& args, size_t index, uint64_t fallback)
+    {
+      return index < args.size() ? std::stoull(args[index]) : fallback;
+    }
+
+    double GetArg(const std::vector<std::string>& args, size_t index, double fallback)
+    {
+      return index < args.size() ? std::stod(args[index]) : fallback;
+    }
+
+    bool WaitUntil(const std::function<bool()>& condition, std::chrono::milliseconds timeout)
+    {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (!condition())
+      {
+        if (std::chrono::steady_clock::now() > deadline)
+          return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      return true;
+    }
+  }
+}
\ No newline at end of file
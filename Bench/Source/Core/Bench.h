@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace rpc
+{
+  namespace bench
+  {
+    // Port the benchmarks listen on, over loopback, one after the other
+    constexpr uint16_t BenchPort = 47100;
+
+    // Run as "NetBench <name> [arguments...]", returns the exit code
+    using BenchFunction = std::function<int(const std::vector<std::string>& args)>;
+
+    struct Bench
+    {
+      std::string name;
+      std::string description;
+      BenchFunction run;
+    };
+
+    // Every benchmark linked in, in no particular order
+    std::vector<Bench>& GetBenches();
+
+    // Adds a benchmark to the list before main runs, one of these lives next to each
+    struct BenchRegistration
+    {
+      BenchRegistration(std::string name, std::string description, BenchFunction run);
+    };
+
+    // CPU time the whole process has used so far, in seconds
+    struct CPUTime
+    {
+      double user = 0.0;
+      double system = 0.0;
+
+      double Total() const
+      {
+        return user + system;
+      }
+    };
+
+    CPUTime GetCPUTime();
+
+    // Socket system calls the whole process has made so far. They are counted on Linux
+    // by wrapping the libc calls asio makes (SyscallCounter.cpp), elsewhere, and for
+    // what io_uring submits, they stay at zero
+    struct SyscallCount
+    {
+      uint64_t sends = 0;
+      uint64_t receives = 0;
+      // epoll_wait, each one a trip of a context thread through the reactor
+      uint64_t waits = 0;
+    };
+
+    SyscallCount GetSyscallCount();
+    bool CanCountSyscalls();
+
+    // Heap allocations the whole process has made so far, through operator new
+    // (AllocationCounter.cpp)
+    uint64_t GetAllocationCount();
+    // Only those of the calling thread
+    uint64_t GetThreadAllocationCount();
+
+    // The "percentile" (0 to 100) of the samples, which get sorted
+    double Percentile(std::vector<double>& samples, double percentile);
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start);
+
+    // Argument "index" as a number, or "fallback" if there is none
+    uint64_t GetArg(const std::vector<std::string>& args, size_t index, uint64_t fallback);
+    double GetArg(const std::vector<std::string>& args, size_t index, double fallback);
+
+    // Poll "condition" until it holds or "timeout" is up, returns whether it held
+    bool WaitUntil(const std::function<bool()>& condition, std::chrono::milliseconds timeout);
+  }
+}
\ No newline at end of file
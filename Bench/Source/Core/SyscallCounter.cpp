@@ -0,0 +1,111 @@
+// Counts the socket system calls asio makes, by defining the libc functions it calls
+// in the executable itself. asio is header only, so every call it makes binds to these,
+// which count and hand over to libc. Nothing here may include the socket headers, with
+// _FORTIFY_SOURCE they define some of these functions inline themselves
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(PLATFORM_LINUX)
+#include <dlfcn.h>
+#include <sys/types.h>
+#endif
+
+#include "Core/Bench.h"
+
+namespace
+{
+  std::atomic<uint64_t> s_Sends = 0;
+  std::atomic<uint64_t> s_Receives = 0;
+  std::atomic<uint64_t> s_Waits = 0;
+
+#if defined(PLATFORM_LINUX)
+  template<typename F>
+  F Next(const char* name)
+  {
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+  }
+#endif
+}
+
+namespace rpc
+{
+  namespace bench
+  {
+    SyscallCount GetSyscallCount()
+    {
+      SyscallCount count;
+      count.sends = s_Sends.load();
+      count.receives = s_Receives.load();
+      count.waits = s_Waits.load();
+      return count;
+    }
+
+    bool CanCountSyscalls()
+    {
+#if defined(PLATFORM_LINUX)
+      return true;
+#else
+      return false;
+#endif
+    }
+  }
+}
+
+#if defined(PLATFORM_LINUX)
+struct msghdr;
+struct sockaddr;
+struct epoll_event;
+
+extern "C"
+{
+  ssize_t sendmsg(int fd, const msghdr* msg, int flags)
+  {
+    static auto next = Next<ssize_t(*)(int, const msghdr*, int)>("sendmsg");
+    s_Sends++;
+    return next(fd, msg, flags);
+  }
+
+  ssize_t send(int fd, const void* data, size_t size, int flags)
+  {
+    static auto next = Next<ssize_t(*)(int, const void*, size_t, int)>("send");
+    s_Sends++;
+    return next(fd, data, size, flags);
+  }
+
+  ssize_t sendto(int fd, const void* data, size_t size, int flags, const sockaddr* address, unsigned int addressSize)
+  {
+    static auto next = Next<ssize_t(*)(int, const void*, size_t, int, const sockaddr*, unsigned int)>("sendto");
+    s_Sends++;
+    return next(fd, data, size, flags, address, addressSize);
+  }
+
+  ssize_t recvmsg(int fd, msghdr* msg, int flags)
+  {
+    static auto next = Next<ssize_t(*)(int, msghdr*, int)>("recvmsg");
+    s_Receives++;
+    return next(fd, msg, flags);
+  }
+
+  ssize_t recv(int fd, void* data, size_t size, int flags)
+  {
+    static auto next = Next<ssize_t(*)(int, void*, size_t, int)>("recv");
+    s_Receives++;
+    return next(fd, data, size, flags);
+  }
+
+  ssize_t recvfrom(int fd, void* data, size_t size, int flags, sockaddr* address, unsigned int* addressSize)
+  {
+    static auto next = Next<ssize_t(*)(int, void*, size_t, int, sockaddr*, unsigned int*)>("recvfrom");
+    s_Receives++;
+    return next(fd, data, size, flags, address, addressSize);
+  }
+
+  int epoll_wait(int fd, epoll_event* events, int maxEvents, int timeout)
+  {
+    static auto next = Next<int(*)(int, epoll_event*, int, int)>("epoll_wait");
+    s_Waits++;
+    return next(fd, events, maxEvents, timeout);
+  }
+}
+#endif
\ No newline at end of file
@@ -18,8 +18,21 @@ int main()
 
   netClient.Connect(rpc::net::parent_id, rpc::net::parent_port);
 
+  std::vector<rpc::net::owned_message<rpc::net::message_type>> incomingMessages;
+  std::chrono::steady_clock::time_point lastStatsTime = std::chrono::steady_clock::now();
+
+  // A dropped link is retried almost at once, then less and less often while it stays down
+  rpc::net::reconnect_backoff reconnectBackoff;
+
   while (true)
   {
+    // Connecting never takes longer than the connect timeout, nothing to do until then
+    if (netClient.IsConnecting())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+
     if (netClient.IsConnected())
     {
       rpc::frame_data frame = screenRecorder.GetFrame();
@@ -34,12 +47,19 @@ int main()
           netClient.SendFrameData(frame);
         }
 
-        netClient.SendFramePixels(frame);
+        netClient.SendFramePixels(std::move(frame));
       }
 
-      if (!netClient.Incoming().empty())
+      if (std::chrono::steady_clock::now() - lastStatsTime >= std::chrono::seconds(1))
       {
-        auto msg = netClient.Incoming().pop_front().msg;
+        netClient.SendStats();
+        lastStatsTime = std::chrono::steady_clock::now();
+      }
+
+      netClient.Incoming().drain(incomingMessages);
+      for (auto& incoming : incomingMessages)
+      {
+        auto& msg = incoming.msg;
 
         switch (msg.header.id)
         {
@@ -51,13 +71,47 @@ int main()
             YK_INFO("[NETWORK] Recieved a request to set the quality to '{}'", frameQuality);
             break;
           }
+          case rpc::net::message_type::server_pacing_rate_change:
+          {
+            uint64_t pacingRate = 0;
+            msg >> pacingRate;
+            netClient.SetPacingRate(pacingRate);
+            YK_INFO("[NETWORK] Pacing frames at {}KB/s", pacingRate / 1024);
+            break;
+          }
+          case rpc::net::message_type::server_ping:
+          {
+            // The ping may have waited behind a frame capture, it counts as received
+            // when it was queued
+            uint64_t pingTime = 0;
+            msg >> pingTime;
+            netClient.SendPong(pingTime, rpc::net::to_timestamp(incoming.received));
+            break;
+          }
+          case rpc::net::message_type::server_resume_token:
+          {
+            // Handed out for a new session, or handed back when the old one was resumed,
+            // either way the connection works
+            uint64_t token = 0;
+            msg >> token;
+            netClient.SetResumeToken(token);
+            reconnectBackoff.Reset();
+            break;
+          }
         }
+
+        netClient.Recycle(std::move(msg));
       }
+      incomingMessages.clear();
     }
     else
     {
-      std::this_thread::sleep_for(std::chrono::seconds(5));
-      netClient.Connect(rpc::net::parent_id, rpc::net::parent_port);
+      std::chrono::milliseconds delay = reconnectBackoff.Next();
+      YK_INFO("[NETWORK] Disconnected, reconnecting in {}ms (attempt {})", delay.count(), reconnectBackoff.GetAttempts());
+      std::this_thread::sleep_for(delay);
+
+      if (netClient.Connect(rpc::net::parent_id, rpc::net::parent_port))
+        netClient.Resume();
     }
   }
 }
\ No newline at end of file
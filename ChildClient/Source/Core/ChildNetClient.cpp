@@ -1,23 +1,113 @@
 #include "Core/ChildNetClient.h"
 
+#include <YKLib.h>
+
 namespace rpc
 {
+  ChildNetClient::ChildNetClient()
+  {
+    // Only the freshest frame is worth sending, on a slow link an unsent frame is
+    // replaced by the next one instead of piling up behind it
+    SetSuperseding(net::message_type::client_frame_pixels_update);
+
+    // Frames go on a connection of their own, a segment lost in the middle of one
+    // must not hold up the parent's quality changes behind it
+    SetSessionMode(true);
+
+    // On the LAN a late frame is worthless, there frames go as datagrams with parity
+    // and are never retransmitted, a lost one is simply replaced by the next. A parent
+    // further away gets them over TCP
+    SetDatagramType(net::message_type::client_frame_pixels_update);
+
+    // The parent is on the LAN, an endpoint that has not answered within a second is
+    // not going to, and the main loop is back to capturing (or retrying) within three
+    SetConnectTimeout(std::chrono::seconds(1), std::chrono::seconds(3));
+    SetConnectHandler([](net::connect_status status, const asio::ip::tcp::endpoint& endpoint, const asio::error_code& ec)
+      {
+        switch (status)
+        {
+          case net::connect_status::attempt_failed:
+            YK_WARN("[NETWORK] Could not reach {}:{}, {}", endpoint.address().to_string(), endpoint.port(), ec.message());
+            break;
+          case net::connect_status::failed:
+            YK_WARN("[NETWORK] Could not connect to the parent, {}", ec.message());
+            break;
+          case net::connect_status::connected:
+            YK_INFO("[NETWORK] Connected to {}:{}", endpoint.address().to_string(), endpoint.port());
+            break;
+          default:
+            break;
+        }
+      });
+  }
+
   void ChildNetClient::SendFrameData(frame_data& frame)
   {
     net::message<net::message_type> msg;
     msg.header.id = net::message_type::client_frame_data_update;
 
     msg << frame.width << frame.height << frame.quality;
-    ChildNetClient::Send(msg);
+    m_LastFrameData = net::shared_message<net::message_type>(std::move(msg));
+    ChildNetClient::Send(m_LastFrameData);
   }
 
-  void ChildNetClient::SendFramePixels(frame_data& frame)
+  void ChildNetClient::SendFramePixels(frame_data&& frame)
   {
     net::message<net::message_type> msg;
     msg.header.id = net::message_type::client_frame_pixels_update;
 
-    msg.push_back(frame.pixels);
-    msg << frame.size;
-    ChildNetClient::Send(msg);
+    msg.push_back(std::move(frame.pixels));
+    msg << frame.captureTime << frame.size;
+    m_LastFramePixels = net::shared_message<net::message_type>(std::move(msg));
+    if (IsConnected() && ChildNetClient::Send(m_LastFramePixels))
+      m_SentFrames++;
+  }
+
+  void ChildNetClient::SendStats()
+  {
+    net::message<net::message_type> msg;
+    msg.header.id = net::message_type::client_stats_update;
+
+    // On the LAN frames go as datagrams or through shared memory once the session is
+    // set up, elsewhere through the send queue. What the parent needs is how many were
+    // sent, to tell how many the link lost, and how many never left
+    uint64_t droppedFrames = GetSupersededMessages() + GetDatagramStats().superseded + GetSharedMemoryStats().dropped;
+    msg << static_cast<uint64_t>(GetQueuedBytes()) << droppedFrames << m_SentFrames;
+    ChildNetClient::Send(std::move(msg), net::message_priority::control);
+  }
+
+  void ChildNetClient::SendPong(uint64_t pingTime, uint64_t receiveTime)
+  {
+    net::message<net::message_type> msg;
+    msg.header.id = net::message_type::client_pong;
+
+    msg << pingTime << receiveTime << net::timestamp_now();
+    ChildNetClient::Send(std::move(msg), net::message_priority::control);
+  }
+
+  void ChildNetClient::SetResumeToken(uint64_t token)
+  {
+    m_ResumeToken = token;
+  }
+
+  void ChildNetClient::Resume()
+  {
+    // Without a token this is a first connection, the parent starts a session for it
+    if (m_ResumeToken != 0)
+    {
+      net::message<net::message_type> msg;
+      msg.header.id = net::message_type::client_resume;
+
+      msg << m_ResumeToken;
+      ChildNetClient::Send(std::move(msg), net::message_priority::control);
+    }
+
+    // Queued now, written as soon as the connection is up. They go ahead of bulk traffic,
+    // on the first connection right behind the token, so they can't overtake it on the
+    // bulk lane or as datagrams
+    if (m_LastFrameData.header.size > 0)
+      ChildNetClient::Send(m_LastFrameData, net::message_priority::interactive);
+    if (m_LastFramePixels.header.size > 0)
+      ChildNetClient::Send(m_LastFramePixels, net::message_priority::interactive);
   }
 }
\ No newline at end of file
@@ -10,8 +10,28 @@ namespace rpc
   class ChildNetClient : public net::ClientInterface<net::message_type>
   {
   public:
+    ChildNetClient();
+
     void SendFrameData(frame_data& frame);
-    void SendFramePixels(frame_data& frame);
+    void SendFramePixels(frame_data&& frame);
+    // Tells the parent how sending frames is going, for its quality controller
+    void SendStats();
+    // Answers the parent's ping with when it arrived and when the answer left
+    void SendPong(uint64_t pingTime, uint64_t receiveTime);
+
+    // Keeps the token the parent handed out, for the next time the connection is lost
+    void SetResumeToken(uint64_t token);
+    // Call right after connecting again. Presents the resume token, then sends the last
+    // frame again so the parent has something fresh to show without waiting for the
+    // next capture
+    void Resume();
 
+  private:
+    uint64_t m_ResumeToken = 0;
+    // Every frame handed to the network, for the parent to work out how many were lost
+    uint64_t m_SentFrames = 0;
+    // The last frame sent, its body is shared with the message so keeping it costs nothing
+    net::shared_message<net::message_type> m_LastFrameData;
+    net::shared_message<net::message_type> m_LastFramePixels;
   };
 }
\ No newline at end of file
@@ -70,6 +70,7 @@ namespace rpc
     Microsoft::WRL::ComPtr<IDXGIResource> desktopResource;
 
     result = m_DXGIOutputDuplication->AcquireNextFrame(100, &frameInfo, &desktopResource);
+    uint64_t captureTime = net::timestamp_now();
 
     if (result == DXGI_ERROR_WAIT_TIMEOUT)
     {
@@ -168,6 +169,9 @@ namespace rpc
       return frame_data();
     }
 
+    // Leave room for the trailers the network client appends, so the JPEG can be
+    // adopted as the message body without growing (and copying) it again
+    JPEGBuffer.data.reserve(jpegSize + sizeof(frame_data::size) + sizeof(frame_data::captureTime));
     JPEGBuffer.data.assign(jpegBuf, jpegBuf + jpegSize);
     tjFree(jpegBuf);
 
@@ -177,6 +181,7 @@ namespace rpc
     frameData.quality = m_FrameQuality;
     frameData.pixels = std::move(JPEGBuffer.data);
     frameData.size = frameData.pixels.size();
+    frameData.captureTime = captureTime;
 
     YK_INFO("{}ms", static_cast<int32_t>(timer.ElapsedMilliseconds()));
     return frameData;
@@ -19,6 +19,8 @@ namespace rpc
     uint32_t height = 0;
     uint32_t width = 0;
     uint64_t size = 0;
+    // When the frame was captured, see net::to_timestamp
+    uint64_t captureTime = 0;
     std::vector<uint8_t> pixels;
 
     bool is_valid() const
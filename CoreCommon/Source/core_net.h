@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 
 namespace rpc
@@ -11,10 +13,34 @@ namespace rpc
       client_frame_data_update,
       client_frame_pixels_update,
       client_input_update,
+      client_stats_update,
+      client_pong,
+      // First thing a child says when it is back after losing its connection, with the
+      // resume token the parent handed it. The parent carries on with the session it
+      // had, last frame and quality settings included, instead of starting a new one
+      client_resume,
 
-      server_frame_quality_change
+      server_frame_quality_change,
+      // Bytes per second the child paces its frames at over TCP, zero for no pacing
+      server_pacing_rate_change,
+      server_ping,
+      // Handed once to every new child, see client_resume
+      server_resume_token
     };
 
+    // Timestamps travel as microseconds of the sender's steady clock. Every machine's
+    // steady clock starts somewhere else, the parent works out the offset between its
+    // own and each child's from the ping/pong round trips
+    inline uint64_t to_timestamp(std::chrono::steady_clock::time_point time)
+    {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count());
+    }
+
+    inline uint64_t timestamp_now()
+    {
+      return to_timestamp(std::chrono::steady_clock::now());
+    }
+
     static constexpr const char* parent_id = "127.0.0.1"; //192.168.1.11
     static constexpr uint16_t parent_port = 12120;
   }
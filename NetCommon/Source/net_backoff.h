@@ -0,0 +1,51 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// How long to wait before each attempt to reconnect. Every failed attempt doubles
+		// the longest wait, up to a cap, and the wait actually used is picked at random
+		// below it. A link that only blinked is back almost at once, one that stays down
+		// is not hammered, and a room of clients that lost the server at the same moment
+		// does not come back all at the same moment either
+		class reconnect_backoff
+		{
+		public:
+			reconnect_backoff(std::chrono::milliseconds base = std::chrono::milliseconds(50), std::chrono::milliseconds cap = std::chrono::seconds(5))
+				: m_Base(base), m_Cap(cap)
+			{
+			}
+
+		public:
+			// Wait before the next attempt, counting it as one more failure
+			std::chrono::milliseconds Next()
+			{
+				int64_t nLongest = m_Base.count() << std::min<uint32_t>(m_nAttempts, 20);
+				m_nAttempts++;
+
+				std::uniform_int_distribution<int64_t> distribution(0, std::min<int64_t>(nLongest, m_Cap.count()));
+				return std::chrono::milliseconds(distribution(m_Random));
+			}
+
+			// Back to short waits, once a connection has worked
+			void Reset()
+			{
+				m_nAttempts = 0;
+			}
+
+			uint32_t GetAttempts() const
+			{
+				return m_nAttempts;
+			}
+
+		private:
+			std::chrono::milliseconds m_Base;
+			std::chrono::milliseconds m_Cap;
+			uint32_t m_nAttempts = 0;
+			std::mt19937 m_Random{ std::random_device{}() };
+		};
+	}
+}
\ No newline at end of file
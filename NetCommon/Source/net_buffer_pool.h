@@ -0,0 +1,154 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// Counters describing how the pool is doing. Once a stream reaches its steady
+		// state "allocations" should stop growing, while "reuses" keeps climbing
+		struct buffer_pool_stats
+		{
+			uint64_t acquires = 0;
+			uint64_t reuses = 0;
+			uint64_t allocations = 0;
+			uint64_t releases = 0;
+			uint64_t discards = 0;
+			// Bytes held by idle buffers right now
+			uint64_t idleBytes = 0;
+		};
+
+		// A pool of byte buffers used as message bodies. Buffers are kept in power of two
+		// size classes, so a buffer handed out for one frame can be reused for the next
+		// frame of a similar size without going back to the heap. Buffers may be acquired
+		// and released from any thread.
+		//
+		// What the pool keeps idle is bounded twice: each class keeps at most
+		// "nMaxBuffersPerClass" buffers, which should match the incoming queue a full
+		// backlog of small messages comes from, and all classes together keep at most
+		// "nMaxIdleBytes". A buffer released past either limit is freed
+		class buffer_pool
+		{
+		public:
+			buffer_pool(size_t nMaxBuffersPerClass = 256, size_t nMaxIdleBytes = 16 * 1024 * 1024)
+				: m_nMaxBuffersPerClass(std::max<size_t>(nMaxBuffersPerClass, 1)), m_nMaxIdleBytes(nMaxIdleBytes)
+			{
+				// Reserve the free lists up front, so returning a buffer only allocates while a
+				// class is growing past its deepest backlog so far
+				for (size_t nClass = 0; nClass < ClassCount; nClass++)
+					m_FreeLists[nClass].reserve(std::min({ m_nMaxBuffersPerClass, m_nMaxIdleBytes / ClassSize(nClass), ReservedBuffersPerClass }));
+			}
+
+			buffer_pool(const buffer_pool&) = delete;
+
+		public:
+			// Hand out a buffer holding exactly "size" bytes, reusing a pooled one if possible
+			std::vector<uint8_t> Acquire(size_t size)
+			{
+				m_Acquires++;
+
+				size_t nClass = ClassFor(size);
+				if (nClass < ClassCount)
+				{
+					std::scoped_lock lock(m_Mutex);
+					std::vector<std::vector<uint8_t>>& freeList = m_FreeLists[nClass];
+					if (!freeList.empty())
+					{
+						std::vector<uint8_t> buffer = std::move(freeList.back());
+						freeList.pop_back();
+						m_nIdleBytes -= buffer.capacity();
+						m_Reuses++;
+
+						// The capacity is already there, so this never reallocates
+						buffer.resize(size);
+						return buffer;
+					}
+				}
+
+				// Nothing to reuse, allocate a new buffer rounded up to its size class so
+				// it can serve any later request of the same class
+				m_Allocations++;
+				std::vector<uint8_t> buffer;
+				buffer.reserve(nClass < ClassCount ? ClassSize(nClass) : size);
+				buffer.resize(size);
+				return buffer;
+			}
+
+			// Give a buffer back to the pool, whatever it currently holds is discarded
+			void Release(std::vector<uint8_t>&& buffer)
+			{
+				// Buffers that were moved from (or never came from the pool) are not worth keeping
+				if (buffer.capacity() < ClassSize(0))
+					return;
+
+				m_Releases++;
+
+				// File the buffer under the largest class it can fully serve, huge buffers
+				// are freed rather than being kept around forever
+				size_t nClass = std::bit_width(buffer.capacity()) - 1 - MinClassShift;
+				if (nClass < ClassCount)
+				{
+					std::scoped_lock lock(m_Mutex);
+					std::vector<std::vector<uint8_t>>& freeList = m_FreeLists[nClass];
+					if (freeList.size() < m_nMaxBuffersPerClass && m_nIdleBytes + buffer.capacity() <= m_nMaxIdleBytes)
+					{
+						m_nIdleBytes += buffer.capacity();
+						freeList.push_back(std::move(buffer));
+						return;
+					}
+				}
+
+				m_Discards++;
+			}
+
+			buffer_pool_stats GetStats() const
+			{
+				buffer_pool_stats stats;
+				stats.acquires = m_Acquires.load();
+				stats.reuses = m_Reuses.load();
+				stats.allocations = m_Allocations.load();
+				stats.releases = m_Releases.load();
+				stats.discards = m_Discards.load();
+
+				std::scoped_lock lock(m_Mutex);
+				stats.idleBytes = m_nIdleBytes;
+				return stats;
+			}
+
+		private:
+			// Smallest class whose buffers can hold "size" bytes
+			static size_t ClassFor(size_t size)
+			{
+				if (size <= ClassSize(0))
+					return 0;
+				return std::bit_width(size - 1) - MinClassShift;
+			}
+
+			static constexpr size_t ClassSize(size_t nClass)
+			{
+				return size_t(1) << (nClass + MinClassShift);
+			}
+
+		private:
+			// Classes range from 256 bytes up to 32 MB
+			static constexpr size_t MinClassShift = 8;
+			static constexpr size_t ClassCount = 18;
+
+			static constexpr size_t ReservedBuffersPerClass = 256;
+
+			size_t m_nMaxBuffersPerClass = 0;
+			size_t m_nMaxIdleBytes = 0;
+
+			mutable std::mutex m_Mutex;
+			std::array<std::vector<std::vector<uint8_t>>, ClassCount> m_FreeLists;
+			size_t m_nIdleBytes = 0;
+
+			std::atomic<uint64_t> m_Acquires = 0;
+			std::atomic<uint64_t> m_Reuses = 0;
+			std::atomic<uint64_t> m_Allocations = 0;
+			std::atomic<uint64_t> m_Releases = 0;
+			std::atomic<uint64_t> m_Discards = 0;
+		};
+	}
+}
\ No newline at end of file
@@ -2,7 +2,10 @@
 
 #include "net_connection.h"
 #include "net_message.h"
-#include "net_tsdeque.h"
+#include "net_mpsc_queue.h"
+#include "net_buffer_pool.h"
+#include "net_datagram.h"
+#include "net_shared_memory.h"
 #include "net_common.h"
 
 namespace rpc
@@ -24,23 +27,34 @@ namespace rpc
 			}
 
 		public:
-			// Connect to server with hostname/ip-address and port
+			// Start connecting to server with hostname/ip-address and port. Returns at once,
+			// the hostname is looked up and the connection made in the background, see
+			// connector. IsConnecting stays true until connected or given up, within the
+			// connect timeout. Messages sent meanwhile are written once connected
 			bool Connect(const std::string& host, const uint16_t port)
 			{
+				// Whatever is left of a previous connection goes first
+				Disconnect();
+
 				try
 				{
-					// Resolve hostname/ip-address into tangiable physical address
-					asio::ip::tcp::resolver resolver(m_Context);
-					asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
-
 					// Create connection
-					m_Connection = std::make_unique<connection<T>>(connection<T>::owner::client, m_Context, asio::ip::tcp::socket(m_Context), m_MessagesIn);
+					m_Connection = std::make_unique<connection<T>>(connection<T>::owner::client, m_Context, typename connection<T>::socket_type(asio::make_strand(m_Context)), m_MessagesIn, m_BufferPool);
+					ConfigureConnection(*m_Connection);
+					m_Connection->SetConnectHandler(m_ConnectHandler);
 
-					// Tell the connection object to connect to server
-					m_Connection->ConnectToServer(endpoints);
+					// Tell the connection object to connect to server, in session mode the
+					// first thing it says is that it wants a bulk lane
+					m_Connection->ConnectToServer(host, port,
+						[this]()
+						{
+							if (m_bSessionMode)
+								SendSessionMessage(*m_Connection, session_step::open, 0);
+						});
 
-					// Start Context Thread
-					m_ContextThread = std::thread([this]() { m_Context.run(); });
+					// Start Context Threads
+					for (size_t i = 0; i < m_nThreadCount; i++)
+						m_ContextThreads.emplace_back([this]() { m_Context.run(); });
 				}
 				catch (std::exception& e)
 				{
@@ -53,21 +67,39 @@ namespace rpc
 			// Disconnect from server
 			void Disconnect()
 			{
-				// If connection exists, and it's connected then...
-				if (IsConnected())
-				{
-					// ...disconnect from server gracefully
+				// A token arriving from here on opens no lane, and a lane opened just now is
+				// either seen below or sees this flag and closes itself, see OnSessionMessage
+				m_bDisconnecting.store(true);
+
+				// Close the connections from within their strands, whatever they are still
+				// waiting for is cancelled...
+				if (m_Connection)
 					m_Connection->Disconnect();
-				}
+				if (std::shared_ptr<connection<T>> lane = m_BulkConnection.load())
+					lane->Disconnect();
+				if (std::shared_ptr<datagram_sender<T>> sender = m_DatagramSender.load())
+					sender->Close();
 
-				// Either way, we're also done with the asio context...				
-				m_Context.stop();
-				// ...and its thread
-				if (m_ContextThread.joinable())
-					m_ContextThread.join();
+				// ...so the context runs out of work and its threads finish by themselves.
+				// Stopping it instead would leave the cancelled handlers queued, to be run
+				// by the next Connect against connections that are long gone
+				for (std::thread& thread : m_ContextThreads)
+					if (thread.joinable()) thread.join();
+				m_ContextThreads.clear();
 
-				// Destroy the connection object
-				m_Connection.release();
+				// Threads that ran out of work before the connections were closed left
+				// their handlers behind, run them here
+				m_Context.restart();
+				m_Context.run();
+
+				// Destroy the connection objects, and ready the context for the next Connect
+				m_Connection.reset();
+				m_BulkConnection.store(nullptr);
+				m_DatagramSender.store(nullptr);
+				m_SharedMemorySender.store(nullptr);
+				m_SharedMemoryOffer.store(nullptr);
+				m_Context.restart();
+				m_bDisconnecting.store(false);
 			}
 
 			// Check if client is actually connected to a server
@@ -79,31 +111,406 @@ namespace rpc
 					return false;
 			}
 
+			// Check if the client is still trying to connect. Ask this before IsConnected,
+			// a connect that succeeds in between is then seen as connected, never as neither
+			bool IsConnecting()
+			{
+				if (m_Connection)
+					return m_Connection->IsConnecting();
+				else
+					return false;
+			}
+
 		public:
-			// Send message to server
-			void Send(const message<T>& msg)
+			// Send message to server. Returns false if it could not be queued, because there
+			// is no connection or too many messages are waiting to be written already
+			bool Send(const message<T>& msg, message_priority priority = message_priority::bulk)
+			{
+				return Send(message<T>(msg), priority);
+			}
+
+			// Send message to server, moving it instead of copying its body
+			bool Send(message<T>&& msg, message_priority priority = message_priority::bulk)
 			{
-				if (IsConnected())
-					m_Connection->Send(msg);
+				return Send(shared_message<T>(std::move(msg)), priority);
+			}
+
+			// Send a shared message to server, its body is referenced rather than copied. A
+			// message that is not queued can be sent again as it is
+			bool Send(const shared_message<T>& msg, message_priority priority = message_priority::bulk)
+			{
+				if (!IsConnecting() && !IsConnected())
+					return false;
+
+				// Bulk messages go through shared memory once the server on this host reads
+				// it, datagram types as datagrams when it is only on the local network. Sent
+				// with a more urgent priority they stay on the connection. Datagram types may
+				// be dropped on the way, the rest wait for room in the ring
+				if (priority == message_priority::bulk)
+				{
+					bool bDatagram = std::find(m_DatagramIDs.begin(), m_DatagramIDs.end(), msg.header.id) != m_DatagramIDs.end();
+
+					std::shared_ptr<shared_memory_sender<T>> ring = m_SharedMemorySender.load();
+					if (ring && ring->Fits(msg))
+						return ring->Send(msg, bDatagram);
+
+					std::shared_ptr<datagram_sender<T>> sender = m_DatagramSender.load();
+					if (bDatagram && sender && sender->Send(msg))
+						return true;
+				}
+
+				return m_Connection->Send(msg, priority);
 			}
 
 			// Retrieve queue of messages from server
-			tsdeque<owned_message<T>>& Incoming()
+			mpsc_queue<owned_message<T>>& Incoming()
 			{
 				return m_MessagesIn;
 			}
 
+			// Choose how the connection reads incoming bytes, applies from the next Connect
+			void SetReadMode(typename connection<T>::read_mode mode)
+			{
+				m_ReadMode = mode;
+			}
+
+			// Choose the size of the chunks large messages are sent in, zero sends every
+			// message whole. Applies from the next Connect
+			void SetChunkSize(size_t nChunkSize)
+			{
+				m_ChunkSize = nChunkSize;
+			}
+
+			// Let bulk messages out at no more than this rate, in small slices, see
+			// connection::SetPacingRate. Zero turns pacing off. Applies to the current
+			// connection and its bulk lane right away, so the rate can follow the link
+			void SetPacingRate(size_t nBytesPerSecond, size_t nSliceSize = 16 * 1024)
+			{
+				m_nPacingRate = nBytesPerSecond;
+				m_nPacingSlice = nSliceSize;
+
+				if (m_Connection)
+					m_Connection->SetPacingRate(nBytesPerSecond, nSliceSize);
+				if (std::shared_ptr<connection<T>> lane = m_BulkConnection.load())
+					lane->SetPacingRate(nBytesPerSecond, nSliceSize);
+			}
+
+			// How long a single endpoint, and the whole connect, lookup included, may take
+			// before it is given up. Applies from the next Connect
+			void SetConnectTimeout(std::chrono::milliseconds attemptTimeout, std::chrono::milliseconds totalTimeout)
+			{
+				m_ConnectAttemptTimeout = attemptTimeout;
+				m_ConnectTimeout = totalTimeout;
+			}
+
+			// Told from the asio thread how connecting to the server goes, see
+			// connect_status. Applies from the next Connect
+			void SetConnectHandler(connect_handler handler)
+			{
+				m_ConnectHandler = std::move(handler);
+			}
+
+			// Choose how many threads run the asio context, applies from the next Connect.
+			// The connection lives on a strand, so its handlers never overlap
+			void SetThreadCount(size_t nThreads)
+			{
+				m_nThreadCount = std::max<size_t>(nThreads, 1);
+			}
+
+			// In session mode a second connection is opened to the server once connected,
+			// bulk messages go on it so they never hold up control and interactive ones.
+			// Applies from the next Connect
+			void SetSessionMode(bool bSessionMode)
+			{
+				m_bSessionMode = bSessionMode;
+			}
+
+			// Messages of this type are sent as UDP datagrams, with a parity datagram per
+			// "nGroupSize" data ones so one loss in a group can be repaired, and never
+			// retransmitted. Only used when the server is on the local network, anywhere
+			// else they stay on TCP. Needs session mode, applies from the next Connect
+			void SetDatagramType(T id, size_t nGroupSize = 8)
+			{
+				m_DatagramIDs.push_back(id);
+				m_nDatagramGroupSize = nGroupSize;
+			}
+
+			// Drop this share of outgoing datagrams on purpose, to test how a lossy
+			// link is coped with. Applies from the next Connect
+			void SetDatagramLossRate(double lossRate)
+			{
+				m_DatagramLossRate = lossRate;
+			}
+
+			datagram_stats GetDatagramStats() const
+			{
+				std::shared_ptr<datagram_sender<T>> sender = m_DatagramSender.load();
+				return sender ? sender->GetStats() : datagram_stats();
+			}
+
+			// When the server turns out to be on this host, bulk messages are written into a
+			// ring in memory shared with it instead, see shared_memory_ring. Those already
+			// on their way over TCP may arrive after the first ones through the ring. Needs
+			// session mode, the server must accept it too. Applies from the next Connect
+			void SetSharedMemoryTransport(bool bSharedMemory, size_t nRingSize = 16 * 1024 * 1024)
+			{
+				m_bSharedMemory = bSharedMemory;
+				m_nSharedMemorySize = nRingSize;
+			}
+
+			// True once bulk messages go through shared memory
+			bool IsUsingSharedMemory() const
+			{
+				return m_SharedMemorySender.load() != nullptr;
+			}
+
+			shared_memory_stats GetSharedMemoryStats() const
+			{
+				std::shared_ptr<shared_memory_sender<T>> ring = m_SharedMemorySender.load();
+				return ring ? ring->GetStats() : shared_memory_stats();
+			}
+
+			// Messages of this type replace an older unsent one of the same type instead of
+			// queueing behind it. Applies from the next Connect
+			void SetSuperseding(T id)
+			{
+				m_SupersedingIDs.push_back(id);
+			}
+
+			// Number of messages (and bytes) sent to the server but not written yet
+			size_t GetQueuedMessages() const
+			{
+				return m_Connection ? m_Connection->GetQueuedMessages() : 0;
+			}
+
+			size_t GetQueuedBytes() const
+			{
+				return m_Connection ? m_Connection->GetQueuedBytes() : 0;
+			}
+
+			// Number of messages dropped because a newer one superseded them
+			size_t GetSupersededMessages() const
+			{
+				return m_Connection ? m_Connection->GetSupersededMessages() : 0;
+			}
+
+			// Give the body of a handled message back to the pool, ready to receive
+			// another message
+			void Recycle(message<T>&& msg)
+			{
+				m_BufferPool.Release(std::move(msg.body));
+			}
+
+			// Counters of the pool incoming message bodies are read into
+			buffer_pool_stats GetBufferPoolStats() const
+			{
+				return m_BufferPool.GetStats();
+			}
+
+		private:
+			// Apply the settings chosen so far to a new connection
+			void ConfigureConnection(connection<T>& conn)
+			{
+				conn.SetReadMode(m_ReadMode);
+				conn.SetChunkSize(m_ChunkSize);
+				conn.SetPacingRate(m_nPacingRate, m_nPacingSlice);
+				conn.SetConnectTimeout(m_ConnectAttemptTimeout, m_ConnectTimeout);
+				for (T id : m_SupersedingIDs)
+					conn.SetSuperseding(id);
+				conn.SetProgressHandler(
+					[this](std::shared_ptr<connection<T>>, const message_header<T>& header, const stream_progress& progress)
+					{
+						OnMessageProgress(header, progress);
+					});
+				conn.SetSessionHandler(
+					[this](connection<T>&, message<T>& msg)
+					{
+						OnSessionMessage(msg);
+					});
+			}
+
+			static void SendSessionMessage(connection<T>& conn, session_step step, uint64_t nToken)
+			{
+				message<T> msg;
+				msg.header.flags = message_flags::session;
+				msg << nToken << step;
+				conn.Send(std::move(msg), message_priority::control);
+			}
+
+			// Called from within the connection's strand when the server answers the
+			// session request with a token, open the bulk lane and present it there
+			void OnSessionMessage(message<T>& msg)
+			{
+				if (msg.body.size() != sizeof(uint64_t) + sizeof(session_step))
+					return;
+
+				session_step step;
+				uint64_t nToken = 0;
+				msg >> step >> nToken;
+
+				// The server has the ring open, from now on it carries the bulk messages
+				if (step == session_step::shared_memory)
+				{
+					if (std::shared_ptr<shared_memory_sender<T>> offer = m_SharedMemoryOffer.load())
+						m_SharedMemorySender.store(std::move(offer));
+					return;
+				}
+
+				if (step != session_step::token || m_bDisconnecting.load() || m_BulkConnection.load())
+					return;
+
+				// Everything else goes to the endpoint that won the connect
+				asio::ip::tcp::endpoint remote = m_Connection->GetRemoteEndpoint();
+
+				// Datagrams go to the port the server is listening on, over UDP. Past the
+				// local network they would be lost more often than parity can repair
+				if (!m_DatagramIDs.empty() && IsOnLocalNetwork(remote.address(), m_Connection->GetLocalEndpoint().address()))
+				{
+					try
+					{
+						auto sender = std::make_shared<datagram_sender<T>>(m_Context, asio::ip::udp::endpoint(remote.address(), remote.port()), nToken, m_nDatagramGroupSize);
+						sender->SetLossRate(m_DatagramLossRate);
+						m_DatagramSender.store(std::move(sender));
+					}
+					catch (std::exception& e)
+					{
+						// Without datagrams these messages simply keep going over TCP
+						std::cerr << "Client Datagram Exception: " << e.what() << "\n";
+					}
+				}
+
+				// A server on this very host is offered a ring in shared memory, sparing
+				// every bulk message the trip through the network stack. The bulk lane and
+				// datagrams carry on until it says it reads from it
+				if (m_bSharedMemory && IsLocal(remote.address(), m_Connection->GetLocalEndpoint().address()))
+				{
+					try
+					{
+						m_SharedMemoryOffer.store(std::make_shared<shared_memory_sender<T>>(GetSharedMemoryName(nToken), m_nSharedMemorySize));
+						SendSessionMessage(*m_Connection, session_step::shared_memory, nToken);
+					}
+					catch (std::exception& e)
+					{
+						std::cerr << "Client Shared Memory Exception: " << e.what() << "\n";
+					}
+				}
+
+				std::shared_ptr<connection<T>> lane = std::make_shared<connection<T>>(connection<T>::owner::client, m_Context, typename connection<T>::socket_type(asio::make_strand(m_Context)), m_MessagesIn, m_BufferPool);
+				ConfigureConnection(*lane);
+				m_BulkConnection.store(lane);
+				lane->ConnectToServer({ remote },
+					[this, pLane = lane.get(), nToken]()
+					{
+						// The token goes out first, everything after it is bulk traffic
+						SendSessionMessage(*pLane, session_step::join, nToken);
+						m_Connection->SetBulkLane(m_BulkConnection.load());
+					});
+
+				// A Disconnect that found no lane, or found it before it was connecting, has
+				// its flag up by now, so the lane is closed here instead
+				if (m_bDisconnecting.load())
+					lane->Disconnect();
+			}
+
+			// The server is on this host when it is reached over loopback, or over an
+			// address of this host's own
+			static bool IsLocal(const asio::ip::address& remote, const asio::ip::address& local)
+			{
+				return remote.is_loopback() || remote == local;
+			}
+
+			// asio does not tell the netmask of an interface, so the server counts as on the
+			// local network when both ends have private addresses from the same range
+			static bool IsOnLocalNetwork(const asio::ip::address& remote, const asio::ip::address& local)
+			{
+				if (IsLocal(remote, local))
+					return true;
+
+				if (remote.is_v4() && local.is_v4())
+				{
+					// 10/8, 172.16/12, 192.168/16 and link-local 169.254/16
+					static constexpr std::array<std::pair<uint32_t, uint32_t>, 4> PrivateRanges = { {
+						{ 0x0A000000, 0xFF000000 }, { 0xAC100000, 0xFFF00000 }, { 0xC0A80000, 0xFFFF0000 }, { 0xA9FE0000, 0xFFFF0000 } } };
+
+					uint32_t nRemote = remote.to_v4().to_uint();
+					uint32_t nLocal = local.to_v4().to_uint();
+					return std::any_of(PrivateRanges.begin(), PrivateRanges.end(),
+						[&](const std::pair<uint32_t, uint32_t>& range) { return (nRemote & range.second) == range.first && (nLocal & range.second) == range.first; });
+				}
+
+				if (remote.is_v6() && local.is_v6())
+				{
+					// Link-local, or unique local addresses (fc00::/7) of the same site
+					asio::ip::address_v6 remote6 = remote.to_v6(), local6 = local.to_v6();
+					if (remote6.is_link_local() && local6.is_link_local())
+						return true;
+
+					asio::ip::address_v6::bytes_type remoteBytes = remote6.to_bytes(), localBytes = local6.to_bytes();
+					return (remoteBytes[0] & 0xFE) == 0xFC && std::equal(remoteBytes.begin(), remoteBytes.begin() + 6, localBytes.begin());
+				}
+
+				return false;
+			}
+
+		protected:
+			// Called from the asio thread each time a chunk of a large message arrives, so
+			// the part received so far can be used before the whole message is in
+			virtual void OnMessageProgress(const message_header<T>& header, const stream_progress& progress)
+			{
+
+			}
+
 		protected:
+			// Pool of incoming message bodies. Declared first, so it outlives
+			// the connection reading into its buffers. Each size class keeps at most a
+			// full incoming queue of idle buffers, and all of them together at most
+			// MaxIdleBufferBytes
+			static constexpr size_t IncomingQueueSize = 4096;
+			static constexpr size_t MaxIdleBufferBytes = 16 * 1024 * 1024;
+			buffer_pool m_BufferPool{ IncomingQueueSize, MaxIdleBufferBytes };
+
 			// asio context handles the data transfer...
 			asio::io_context m_Context;
-			// ...but needs a thread of its own to execute its work commands
-			std::thread m_ContextThread;
+			// ...but needs threads of its own to execute its work commands
+			std::vector<std::thread> m_ContextThreads;
+			size_t m_nThreadCount = 1;
 			// The client has a single instance of a "connection" object, which handles data transfer
 			std::unique_ptr<connection<T>> m_Connection;
+			// How the connection reads incoming bytes, and sends large messages
+			typename connection<T>::read_mode m_ReadMode = connection<T>::read_mode::exact;
+			size_t m_ChunkSize = 64 * 1024;
+			// Pacing of bulk messages, off unless a rate is set. Read by the asio context
+			// when it opens the bulk lane
+			std::atomic<size_t> m_nPacingRate = 0;
+			std::atomic<size_t> m_nPacingSlice = 16 * 1024;
+			// Message types where only the latest unsent message is worth sending
+			std::vector<T> m_SupersedingIDs;
+			// Connect timeouts, and who is told how connecting goes
+			std::chrono::milliseconds m_ConnectAttemptTimeout = std::chrono::seconds(2);
+			std::chrono::milliseconds m_ConnectTimeout = std::chrono::seconds(5);
+			connect_handler m_ConnectHandler;
+			// Session mode, and the second connection carrying bulk messages
+			// The lane is published from the primary connection's strand and read by Disconnect,
+			// which raises its flag first so a lane opened in between is never missed
+			bool m_bSessionMode = false;
+			std::atomic<std::shared_ptr<connection<T>>> m_BulkConnection;
+			std::atomic<bool> m_bDisconnecting = false;
+			// Message types sent as datagrams, and the sender once the session has a token
+			// and the server is on the local network
+			std::vector<T> m_DatagramIDs;
+			size_t m_nDatagramGroupSize = 8;
+			double m_DatagramLossRate = 0.0;
+			std::atomic<std::shared_ptr<datagram_sender<T>>> m_DatagramSender;
+			// Ring shared with a server on this host, offered once the session has a token
+			// and used once the server has it open
+			bool m_bSharedMemory = true;
+			size_t m_nSharedMemorySize = 16 * 1024 * 1024;
+			std::atomic<std::shared_ptr<shared_memory_sender<T>>> m_SharedMemoryOffer;
+			std::atomic<std::shared_ptr<shared_memory_sender<T>>> m_SharedMemorySender;
 
 		private:
-			// This is the thread safe queue of incoming messages from server
-			tsdeque<owned_message<T>> m_MessagesIn;
+			// This is the lock-free queue of incoming messages from server
+			mpsc_queue<owned_message<T>> m_MessagesIn{ IncomingQueueSize };
 		};
 	}
 }
\ No newline at end of file
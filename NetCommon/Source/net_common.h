@@ -5,12 +5,55 @@
 #include <mutex>
 #include <deque>
 #include <optional>
+#include <functional>
 #include <vector>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <span>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <shared_mutex>
+#include <unordered_map>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <system_error>
 
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
-#include <asio/ts/internet.hpp>
\ No newline at end of file
+#include <asio/ts/internet.hpp>
+
+// The io_uring backend (premake --io-uring) needs asio 1.21 or later, earlier
+// versions quietly keep using epoll for sockets
+#if defined(ASIO_HAS_IO_URING) && ASIO_VERSION < 102100
+	#error "The io_uring backend needs asio 1.21 or later"
+#endif
+
+namespace rpc
+{
+	namespace net
+	{
+		// What asio waits on for socket I/O. It is chosen when asio is compiled, so the
+		// same build always uses the same backend, whatever machine it runs on
+		inline const char* GetIOBackendName()
+		{
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+			return "io_uring";
+#elif defined(ASIO_HAS_IOCP)
+			return "iocp";
+#elif defined(ASIO_HAS_EPOLL)
+			return "epoll";
+#elif defined(ASIO_HAS_KQUEUE)
+			return "kqueue";
+#elif defined(ASIO_HAS_DEV_POLL)
+			return "/dev/poll";
+#else
+			return "select";
+#endif
+		}
+	}
+}
\ No newline at end of file
@@ -2,7 +2,10 @@
 
 #include "net_common.h"
 #include "net_message.h"
-#include "net_tsdeque.h"
+#include "net_mpsc_queue.h"
+#include "net_buffer_pool.h"
+#include "net_handler_alloc.h"
+#include "net_connector.h"
 
 namespace rpc
 {
@@ -12,6 +15,18 @@ namespace rpc
 		class connection : public std::enable_shared_from_this<connection<T>>
 		{
 		public:
+			// Sockets live on a strand of the io_context. Naming the strand type, rather than
+			// letting asio type-erase it, keeps asio from allocating a copy of the executor
+			// for every operation it tracks
+			using socket_type = asio::basic_stream_socket<asio::ip::tcp, asio::strand<asio::io_context::executor_type>>;
+			using timer_type = asio::basic_waitable_timer<std::chrono::steady_clock, asio::wait_traits<std::chrono::steady_clock>, asio::strand<asio::io_context::executor_type>>;
+#if defined(RPC_NET_COROUTINES)
+			// The same goes for the coroutines, a plain asio::awaitable<void> holds the strand
+			// as an any_io_executor, which allocates a copy of it on every co_await
+			using awaitable = asio::awaitable<void, socket_type::executor_type>;
+			static constexpr asio::use_awaitable_t<socket_type::executor_type> use_awaitable{};
+#endif
+
 			// A connection is "owned" by either a server or a client, and its
 			// behaviour is slightly different bewteen the two.
 			enum class owner
@@ -20,17 +35,67 @@ namespace rpc
 				client
 			};
 
+			// How incoming bytes are pulled from the socket. "exact" reads each header
+			// and each body with its own read, "buffered" reads large chunks and splits
+			// as many messages out of every chunk as it holds, which is much cheaper when
+			// lots of small messages arrive
+			enum class read_mode
+			{
+				exact,
+				buffered
+			};
+
+		protected:
+			// What the buffered reader does once the read buffer holds no complete message:
+			// read more into it, read the rest of a large body or chunk straight into its own
+			// buffer, or give up on a remote that sent a chunk that fits nowhere
+			enum class buffered_read
+			{
+				more,
+				body,
+				chunk,
+				invalid
+			};
+
+			// A message waiting to be written, along with its priority, and how much
+			// of its body has gone out so far when it is sent in chunks
+			struct outgoing_message
+			{
+				shared_message<T> msg;
+				message_priority priority = message_priority::bulk;
+				size_t nSent = 0;
+				size_t nWriting = 0;
+
+				// Headers of the chunk currently being written
+				message_header<T> chunkHeader;
+				chunk_header chunk;
+			};
+
+			// Messages waiting for their turn, the blocks the deque drops and takes as
+			// messages flow through it are recycled instead of going back to the heap
+			using pending_queue = std::deque<outgoing_message, recycling_allocator<outgoing_message>>;
+
 		public:
 			// Constructor: Specify Owner, connect to context, transfer the socket
-			//				Provide reference to incoming message queue
-			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsdeque<owned_message<T>>& qIn)
-				: m_AsioContext(asioContext), m_Socket(std::move(socket)), m_MessagesIn(qIn)
+			//				Provide reference to incoming message queue and to the pool
+			//				incoming message bodies are taken from
+			//
+			// The context may be run by several threads. The socket should then be created
+			// on a strand (asio::make_strand), every handler of this connection runs through
+			// the socket's executor, so they never run at the same time as each other
+			connection(owner parent, asio::io_context& asioContext, socket_type socket, mpsc_queue<owned_message<T>>& qIn, buffer_pool& pool)
+				: m_Socket(std::move(socket)), m_AsioContext(asioContext), m_PacingTimer(m_Socket.get_executor()), m_MessagesIn(qIn), m_BufferPool(pool)
 			{
 				m_OwnerType = parent;
+				m_WriteBuffers.reserve(MaxWriteBuffers);
 			}
 
 			virtual ~connection()
 			{
+				// A lookup may still be running, it must not post to a context that goes
+				// with the connection's owner
+				if (m_Connector)
+					m_Connector->Abandon();
 			}
 
 			// This ID is used system wide - its how clients will understand other clients
@@ -40,6 +105,107 @@ namespace rpc
 				return m_ID;
 			}
 
+			// Choose how incoming bytes are read, must be called before the connection
+			// starts reading
+			void SetReadMode(read_mode mode)
+			{
+				m_ReadMode = mode;
+				if (m_ReadMode == read_mode::buffered)
+					m_ReadBuffer.resize(ReadBufferSize);
+			}
+
+			// Bodies larger than this are sent as a stream of chunks of this size, so
+			// smaller messages can go out in between. Zero sends every message whole.
+			// Must be called before the connection starts sending
+			void SetChunkSize(size_t nChunkSize)
+			{
+				m_ChunkSize = nChunkSize;
+			}
+
+			// Let bulk messages out at no more than "nBytesPerSecond", in slices of at most
+			// "nSliceSize" bytes, instead of handing the socket a whole large message at once.
+			// A burst fills the queues of every router on the way, and everything else
+			// crossing them waits behind it. Control and interactive messages are never
+			// held back. Zero turns pacing off. May be changed at any time, from any thread
+			void SetPacingRate(size_t nBytesPerSecond, size_t nSliceSize = DefaultPacingSlice)
+			{
+				m_nPacingSlice.store(std::max<size_t>(nSliceSize, 1), std::memory_order_relaxed);
+				size_t nPrevious = m_nPacingRate.exchange(nBytesPerSecond, std::memory_order_relaxed);
+
+				// A connection that is up gets its socket options from within its strand
+				if (nPrevious == 0 && nBytesPerSecond > 0 && IsConnected())
+					asio::post(m_Socket.get_executor(), [this]() { ApplyPacingOptions(); });
+			}
+
+			// Called from within the asio context each time a chunk of a large message
+			// arrives, before the whole message is complete
+			using progress_handler = std::function<void(std::shared_ptr<connection<T>>, const message_header<T>&, const stream_progress&)>;
+
+			void SetProgressHandler(progress_handler handler)
+			{
+				m_ProgressHandler = std::move(handler);
+			}
+
+			// Called from within the asio context when a session handshake message
+			// arrives, instead of queueing it
+			using session_handler = std::function<void(connection<T>&, message<T>&)>;
+
+			void SetSessionHandler(session_handler handler)
+			{
+				m_SessionHandler = std::move(handler);
+			}
+
+			// Bulk messages sent through this connection go out on "lane" instead, a
+			// second connection to the same remote, so they never hold up the control
+			// and interactive messages sent on this one
+			void SetBulkLane(std::shared_ptr<connection<T>> lane)
+			{
+				m_BulkLane.store(std::move(lane));
+			}
+
+			bool HasBulkLane() const
+			{
+				return m_BulkLane.load() != nullptr;
+			}
+
+			// This connection is the bulk lane of "primary", what arrives on it is
+			// presented as coming from the primary connection. Must be called from
+			// within this connection's strand
+			void SetPrimary(std::weak_ptr<connection<T>> primary)
+			{
+				m_Primary = std::move(primary);
+				m_bIsBulkLane = true;
+			}
+
+			// A message of this type replaces an older one of the same type still waiting
+			// to be sent, rather than queueing behind it. Only the latest message matters
+			// for types like frames, so a slow link drops stale ones instead of piling
+			// them up. Must be called before the connection starts sending
+			void SetSuperseding(T id)
+			{
+				m_SupersedingIDs.push_back(id);
+			}
+
+			// Number of messages (and bytes, headers included) sent but not written yet
+			size_t GetQueuedMessages() const
+			{
+				std::shared_ptr<connection<T>> lane = m_BulkLane.load();
+				return m_nQueuedMessages.load(std::memory_order_relaxed) + (lane ? lane->GetQueuedMessages() : 0);
+			}
+
+			size_t GetQueuedBytes() const
+			{
+				std::shared_ptr<connection<T>> lane = m_BulkLane.load();
+				return m_nQueuedBytes.load(std::memory_order_relaxed) + (lane ? lane->GetQueuedBytes() : 0);
+			}
+
+			// Number of messages dropped because a newer one superseded them
+			size_t GetSupersededMessages() const
+			{
+				std::shared_ptr<connection<T>> lane = m_BulkLane.load();
+				return m_nSupersededMessages.load(std::memory_order_relaxed) + (lane ? lane->GetSupersededMessages() : 0);
+			}
+
 		public:
 			void ConnectToClient(uint32_t uid = 0)
 			{
@@ -48,33 +214,72 @@ namespace rpc
 					if (m_Socket.is_open())
 					{
 						m_ID = uid;
-						ReadHeader();
+
+						// Start reading from within the connection's strand, a send may
+						// already be writing to the socket from another thread
+						asio::dispatch(m_Socket.get_executor(), [this]() { ApplyPacingOptions(); StartTransfer(); });
 					}
 				}
 			}
 
-			void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints)
+			// Look "host" up and connect to it, see connector. Returns at once, anything sent
+			// meanwhile is written once connected. "onConnect" is called from within the
+			// connection's strand once connected, before anything is read
+			void ConnectToServer(const std::string& host, uint16_t port, std::function<void()> onConnect = nullptr)
 			{
-				// Only clients can connect to servers
-				if (m_OwnerType == owner::client)
-				{
-					// Request asio attempts to connect to an endpoint
-					asio::async_connect(m_Socket, endpoints,
-						[this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
-						{
-							if (!ec)
-							{
-								ReadHeader();
-							}
-						});
-				}
+				if (std::shared_ptr<connector> pConnector = MakeConnector(std::move(onConnect)))
+					pConnector->Start(host, port, [this](connector::socket_type& socket) { OnConnected(socket); });
 			}
 
+			// Connect to whichever of "endpoints" answers first
+			void ConnectToServer(std::vector<asio::ip::tcp::endpoint> endpoints, std::function<void()> onConnect = nullptr)
+			{
+				if (std::shared_ptr<connector> pConnector = MakeConnector(std::move(onConnect)))
+					pConnector->Start(std::move(endpoints), [this](connector::socket_type& socket) { OnConnected(socket); });
+			}
+
+			// How long a single endpoint, and the whole connect, lookup included, may take.
+			// Must be called before connecting
+			void SetConnectTimeout(std::chrono::milliseconds attemptTimeout, std::chrono::milliseconds totalTimeout)
+			{
+				m_ConnectAttemptTimeout = attemptTimeout;
+				m_ConnectTimeout = totalTimeout;
+			}
+
+			// Told how connecting goes, see connect_status. Must be called before connecting
+			void SetConnectHandler(connect_handler handler)
+			{
+				m_ConnectHandler = std::move(handler);
+			}
+
+			// True from ConnectToServer until connected or given up
+			bool IsConnecting() const
+			{
+				return m_bConnecting.load();
+			}
 
 			void Disconnect()
 			{
-				if (IsConnected())
-					asio::post(m_AsioContext, [this]() { m_Socket.close(); });
+				// Connecting is checked first, a connect that wins sets the socket before
+				// it clears the flag
+				if (IsConnecting() || IsConnected())
+					asio::post(m_Socket.get_executor(),
+						[this]()
+						{
+							if (m_Connector)
+								m_Connector->Cancel();
+							m_bConnecting.store(false);
+							m_Socket.close();
+							m_PacingTimer.cancel();
+							m_IncomingTimer.cancel();
+#if defined(RPC_NET_COROUTINES)
+							m_WriteSignal.cancel();
+#endif
+						});
+
+				// The bulk lane is part of this connection, it goes with it
+				if (std::shared_ptr<connection<T>> lane = m_BulkLane.load())
+					lane->Disconnect();
 			}
 
 			bool IsConnected() const
@@ -82,6 +287,22 @@ namespace rpc
 				return m_Socket.is_open();
 			}
 
+			// Address of the remote side, empty if not connected
+			asio::ip::tcp::endpoint GetRemoteEndpoint() const
+			{
+				asio::error_code ec;
+				asio::ip::tcp::endpoint endpoint = m_Socket.remote_endpoint(ec);
+				return ec ? asio::ip::tcp::endpoint() : endpoint;
+			}
+
+			// Address of this side, empty if not connected
+			asio::ip::tcp::endpoint GetLocalEndpoint() const
+			{
+				asio::error_code ec;
+				asio::ip::tcp::endpoint endpoint = m_Socket.local_endpoint(ec);
+				return ec ? asio::ip::tcp::endpoint() : endpoint;
+			}
+
 			// Prime the connection to wait for incoming messages
 			void StartListening()
 			{
@@ -91,132 +312,417 @@ namespace rpc
 		public:
 			// ASYNC - Send a message, connections are one-to-one so no need to specifiy
 			// the target, for a client, the target is the server and vice versa
-			void Send(const message<T>& msg)
+			void Send(const message<T>& msg, message_priority priority = message_priority::bulk)
+			{
+				Send(message<T>(msg), priority);
+			}
+
+			// ASYNC - Send a message, taking ownership of it so its body is moved all
+			// the way into the outgoing queue without being copied
+			void Send(message<T>&& msg, message_priority priority = message_priority::bulk)
+			{
+				Send(shared_message<T>(std::move(msg)), priority);
+			}
+
+			// ASYNC - Send a shared message, only its reference counted body is queued,
+			// so the same payload can be sent to many connections at no extra cost
+			bool Send(const shared_message<T>& msg, message_priority priority = message_priority::bulk)
+			{
+				return Send(shared_message<T>(msg), priority);
+			}
+
+			bool Send(shared_message<T>&& msg, message_priority priority = message_priority::bulk)
+			{
+				// With a bulk lane attached, bulk messages take it while it is up
+				if (priority == message_priority::bulk)
+				{
+					std::shared_ptr<connection<T>> lane = m_BulkLane.load();
+					if (lane && lane->IsConnected())
+						return lane->Send(std::move(msg), priority);
+				}
+
+				// Any thread may send, the message goes straight into the lock-free
+				// outgoing queue. The asio context is only poked when it is not already
+				// about to look at that queue, so a burst of sends costs a single post.
+				// Send never blocks, and never queues more than MaxQueuedMessages: past
+				// that it returns false and the message is not sent. GetQueuedBytes() is
+				// there to tell a sender to back off before it comes to that
+				if (m_nQueuedMessages.fetch_add(1, std::memory_order_relaxed) >= MaxQueuedMessages)
+				{
+					m_nQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				outgoing_message out;
+				out.msg = std::move(msg);
+				out.priority = priority;
+
+				// Everything in the ring is also counted as queued, so it has room
+				size_t nSize = QueuedSize(out);
+				m_nQueuedBytes.fetch_add(nSize, std::memory_order_relaxed);
+				if (!m_MessagesOut.try_push(std::move(out)))
+				{
+					m_nQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+					m_nQueuedBytes.fetch_sub(nSize, std::memory_order_relaxed);
+					return false;
+				}
+
+				if (!m_bDrainPending.exchange(true))
+					asio::post(m_Socket.get_executor(), make_custom_alloc_handler(m_DrainHandlerMemory, [this]() { DrainOutgoingMessages(); }));
+				return true;
+			}
+
+
+
+		private:
+			std::shared_ptr<connector> MakeConnector(std::function<void()> onConnect)
 			{
-				asio::post(m_AsioContext,
-					[this, msg]()
+				// Only clients can connect to servers
+				if (m_OwnerType != owner::client)
+					return nullptr;
+
+				m_OnConnect = std::move(onConnect);
+				m_bConnecting.store(true);
+				m_Connector = std::make_shared<connector>(m_Socket.get_executor(), m_ConnectAttemptTimeout, m_ConnectTimeout,
+					[this](connect_status status, const asio::ip::tcp::endpoint& endpoint, const asio::error_code& ec)
 					{
-						// If the queue has a message in it, then we must 
-						// assume that it is in the process of asynchronously being written.
-						// Either way add the message to the queue to be output. If no messages
-						// were available to be written, then start the process of writing the
-						// message at the front of the queue.
-						bool bWritingMessage = !m_MessagesOut.empty();
-						m_MessagesOut.push_back(msg);
-						if (!bWritingMessage)
-						{
-							WriteHeader();
-						}
+						if (status == connect_status::failed)
+							m_bConnecting.store(false);
+						if (m_ConnectHandler)
+							m_ConnectHandler(status, endpoint, ec);
 					});
+				return m_Connector;
+			}
+
+			// Called from within the strand with the socket that won the race
+			void OnConnected(connector::socket_type& socket)
+			{
+				m_Socket = std::move(socket);
+				m_bConnecting.store(false);
+
+				ApplyPacingOptions();
+				if (m_OnConnect)
+					m_OnConnect();
+				StartTransfer();
 			}
 
+			// Move everything sent so far into the pending queue of its priority, and
+			// start writing if we are not already
+			void DrainOutgoingMessages()
+			{
+				// Clear the flag first, so anything sent from now on schedules another drain
+				m_bDrainPending.store(false);
 
+				outgoing_message out;
+				while (m_MessagesOut.try_pop(out))
+				{
+					if (!Supersede(out))
+						m_MessagesPending[static_cast<size_t>(out.priority)].push_back(std::move(out));
+				}
 
-		private:
-			// ASYNC - Prime context to write a message header
-			void WriteHeader()
-			{
-				// If this function is called, we know the outgoing message queue must have 
-				// at least one message to send. So allocate a transmission buffer to hold
-				// the message, and issue the work - asio, send these bytes
-				asio::async_write(m_Socket, asio::buffer(&m_MessagesOut.front().header, sizeof(message_header<T>)),
-					[this](std::error_code ec, std::size_t length)
+#if defined(RPC_NET_COROUTINES)
+				// The write loop may be waiting for something to send, wake it
+				if (!m_bWritingMessages && HasPendingMessages())
+					m_WriteSignal.cancel();
+#else
+				// Anything sent while still connecting waits for the connection
+				if (m_bTransferring && !m_bWritingMessages && HasPendingMessages())
+					WriteMessages();
+#endif
+			}
+
+			// If the message is of a superseding type, and an older one of the same type is
+			// still waiting untouched in its queue, take that one's place and drop it
+			bool Supersede(outgoing_message& out)
+			{
+				if (std::find(m_SupersedingIDs.begin(), m_SupersedingIDs.end(), out.msg.header.id) == m_SupersedingIDs.end())
+					return false;
+
+				// Messages in the write in flight, or partially streamed, must be left alone
+				pending_queue& pending = m_MessagesPending[static_cast<size_t>(out.priority)];
+				size_t nFirst = m_bWritingMessages ? m_BatchSizes[static_cast<size_t>(out.priority)] : 0;
+				for (size_t i = nFirst; i < pending.size(); i++)
+				{
+					if (pending[i].msg.header.id == out.msg.header.id && pending[i].nSent == 0)
+					{
+						m_nQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+						m_nQueuedBytes.fetch_sub(QueuedSize(pending[i]), std::memory_order_relaxed);
+						m_nSupersededMessages.fetch_add(1, std::memory_order_relaxed);
+
+						pending[i] = std::move(out);
+						return true;
+					}
+				}
+				return false;
+			}
+
+			static size_t QueuedSize(const outgoing_message& out)
+			{
+				return sizeof(message_header<T>) + out.msg.size();
+			}
+
+			bool HasPendingMessages() const
+			{
+				for (const pending_queue& pending : m_MessagesPending)
+				{
+					if (!pending.empty())
+						return true;
+				}
+				return false;
+			}
+
+			// ASYNC - Prime context to write as many queued messages as fit in one write
+			void WriteMessages()
+			{
+				// If this function is called, we know a pending message queue must have 
+				// at least one message to send. Rather than writing the header and the body
+				// of each message separately, gather the headers and bodies of as many
+				// pending messages as the socket accepts in a single scatter/gather write.
+				// The queues are visited in priority order, so control and interactive
+				// messages always go out ahead of the next bulk message (or chunk of one).
+				// The messages stay in their queues until the write completes, so the
+				// memory these buffers point to remains valid for the whole operation.
+				if (!GatherPendingMessages())
+				{
+					// Only bulk messages are waiting, and the pacer is holding them back
+					SchedulePacedWrite();
+					return;
+				}
+
+				m_bWritingMessages = true;
+
+				// Hand asio a view of the gathered buffers, so the buffer sequence itself
+				// is not copied into the write operation
+				asio::async_write(m_Socket, std::span<const asio::const_buffer>(m_WriteBuffers),
+					make_custom_alloc_handler(m_WriteHandlerMemory, [this](std::error_code ec, std::size_t length)
 					{
 						// asio has now sent the bytes - if there was a problem
 						// an error would be available...
 						if (!ec)
 						{
-							// ... no error, so check if the message header just sent also
-							// has a message body...
-							if (m_MessagesOut.front().body.size() > 0)
-							{
-								// ...it does, so issue the task to write the body bytes
-								WriteBody();
-							}
-							else
-							{
-								// ...it didnt, so we are done with this message. Remove it from 
-								// the outgoing message queue
-								m_MessagesOut.pop_front();
-
-								// If the queue is not empty, there are more messages to send, so
-								// make this happen by issuing the task to send the next header.
-								if (!m_MessagesOut.empty())
-								{
-									WriteHeader();
-								}
-							}
+							// ... no error, so account for everything that was part of this
+							// write, and remove what is done with from the pending queues
+							for (size_t i = 0; i < m_MessagesPending.size(); i++)
+								RetireMessages(m_MessagesPending[i], m_BatchSizes[i]);
+							m_bWritingMessages = false;
+
+							// Pick up whatever was sent while we were writing, and if there
+							// is anything, send as much of it as possible in the next write.
+							DrainOutgoingMessages();
 						}
 						else
 						{
-							// ...asio failed to write the message, we could analyse why but 
+							// ...asio failed to write the messages, we could analyse why but 
 							// for now simply assume the connection has died by closing the
 							// socket. When a future attempt to write to this client fails due
 							// to the closed socket, it will be tidied up.
-							std::cout << "[" << m_ID << "] Write Header Fail.\n";
+							std::cout << "[" << m_ID << "] Write Messages Fail.\n";
 							m_Socket.close();
 						}
-					});
+					}));
 			}
 
-			// ASYNC - Prime context to write a message body
-			void WriteBody()
+			// Gather the next write from every pending queue, in priority order. When pacing,
+			// bulk messages only go out as far as the pacer allows. Returns false if there
+			// is nothing that may be written yet
+			bool GatherPendingMessages()
 			{
-				// If this function is called, a header has just been sent, and that header
-				// indicated a body existed for this message. Fill a transmission buffer
-				// with the body data, and send it!
-				asio::async_write(m_Socket, asio::buffer(m_MessagesOut.front().body.data(), m_MessagesOut.front().body.size()),
-					[this](std::error_code ec, std::size_t length)
+				m_WriteBuffers.clear();
+				for (size_t i = 0; i < m_MessagesPending.size(); i++)
+				{
+					if (i == static_cast<size_t>(message_priority::bulk) && m_nPacingRate.load(std::memory_order_relaxed) > 0)
+						m_BatchSizes[i] = GatherPacedMessages(m_MessagesPending[i]);
+					else
+						m_BatchSizes[i] = GatherMessages(m_MessagesPending[i], m_ChunkSize);
+				}
+				return !m_WriteBuffers.empty();
+			}
+
+			// Add the messages at the front of a pending queue to the write buffers, for as
+			// long as there is room and fewer than "nMaxBytes" were added, returns how many
+			// messages were added
+			size_t GatherMessages(pending_queue& pending, size_t nChunkSize, size_t nMaxBytes = SIZE_MAX)
+			{
+				size_t nMessages = 0;
+				size_t nBytes = 0;
+				for (outgoing_message& out : pending)
+				{
+					if (nBytes >= nMaxBytes)
+						break;
+
+					// A stream that has started goes on in chunks whatever the chunk size is
+					// now, the remote is waiting for the rest of it
+					const shared_message<T>& msg = out.msg;
+					if (out.nSent == 0 && (nChunkSize == 0 || msg.size() <= nChunkSize))
 					{
-						if (!ec)
-						{
-							// Sending was successful, so we are done with the message
-							// and remove it from the queue
-							m_MessagesOut.pop_front();
+						// Small enough to go out whole
+						size_t nBuffers = msg.size() == 0 ? 1 : 2;
+						if (m_WriteBuffers.size() + nBuffers > MaxWriteBuffers)
+							break;
 
-							// If the queue still has messages in it, then issue the task to 
-							// send the next messages' header.
-							if (!m_MessagesOut.empty())
-							{
-								WriteHeader();
-							}
-						}
-						else
-						{
-							// Sending failed, see WriteHeader() equivalent for description :P
-							std::cout << "[" << m_ID << "] Write Body Fail.\n";
-							m_Socket.close();
-						}
-					});
+						m_WriteBuffers.push_back(asio::buffer(&msg.header, sizeof(message_header<T>)));
+						if (msg.size() > 0)
+							m_WriteBuffers.push_back(asio::buffer(msg.body->data(), msg.body->size()));
+
+						out.nWriting = msg.size();
+					}
+					else
+					{
+						// Too large, only send the next chunk of its body. Whatever is queued
+						// behind it then goes out before the chunk after this one does
+						if (m_WriteBuffers.size() + 3 > MaxWriteBuffers)
+							break;
+
+						if (out.nSent == 0)
+							out.chunk.stream = m_NextStreamID++;
+
+						size_t nLength = msg.size() - out.nSent;
+						if (nChunkSize != 0)
+							nLength = std::min(nChunkSize, nLength);
+						out.chunk.length = static_cast<uint32_t>(nLength);
+						out.chunk.offset = out.nSent;
+						out.chunk.total = msg.size();
+
+						out.chunkHeader.id = msg.header.id;
+						out.chunkHeader.size = static_cast<uint32_t>(sizeof(chunk_header) + nLength);
+						out.chunkHeader.flags = message_flags::chunk;
+
+						m_WriteBuffers.push_back(asio::buffer(&out.chunkHeader, sizeof(message_header<T>)));
+						m_WriteBuffers.push_back(asio::buffer(&out.chunk, sizeof(chunk_header)));
+						m_WriteBuffers.push_back(asio::buffer(msg.body->data() + out.nSent, nLength));
+
+						out.nWriting = nLength;
+					}
+
+					nBytes += sizeof(message_header<T>) + out.nWriting;
+					nMessages++;
+				}
+				return nMessages;
+			}
+
+			// Gather as many bulk bytes as the pacer has tokens for, in slices. Tokens build
+			// up at the pacing rate, up to one slice. Whatever is gathered is taken out of
+			// them right away, which may run them into debt by up to a slice, nothing more
+			// goes out until that is paid off
+			size_t GatherPacedMessages(pending_queue& pending)
+			{
+				size_t nRate = m_nPacingRate.load(std::memory_order_relaxed);
+				size_t nSlice = m_nPacingSlice.load(std::memory_order_relaxed);
+
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				double elapsed = std::chrono::duration<double>(now - m_PacingRefill).count();
+				m_PacingRefill = now;
+				m_PacingTokens = std::min(m_PacingTokens + elapsed * nRate, static_cast<double>(nSlice));
+				if (m_PacingTokens <= 0.0)
+					return 0;
+
+				size_t nChunkSize = m_ChunkSize == 0 ? nSlice : std::min(m_ChunkSize, nSlice);
+				size_t nMessages = GatherMessages(pending, nChunkSize, static_cast<size_t>(m_PacingTokens));
+				for (size_t i = 0; i < nMessages; i++)
+					m_PacingTokens -= static_cast<double>(sizeof(message_header<T>) + pending[i].nWriting);
+				return nMessages;
+			}
+
+			// The pacer already decides when bytes go out, Nagle's algorithm would hold back
+			// the tail of every slice until the one before it is acknowledged
+			void ApplyPacingOptions()
+			{
+				if (m_nPacingRate.load(std::memory_order_relaxed) > 0)
+				{
+					asio::error_code ec;
+					m_Socket.set_option(asio::ip::tcp::no_delay(true), ec);
+				}
+			}
+
+			// How long until the pacer is out of debt, and bulk messages may go again
+			std::chrono::steady_clock::duration PacingDelay() const
+			{
+				size_t nRate = m_nPacingRate.load(std::memory_order_relaxed);
+				if (nRate == 0)
+					return std::chrono::steady_clock::duration::zero();
+				return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((1.0 - m_PacingTokens) / nRate));
+			}
+
+			// ASYNC - Come back to writing once the pacer is out of debt
+			void SchedulePacedWrite()
+			{
+				size_t nRate = m_nPacingRate.load(std::memory_order_relaxed);
+				if (m_bPacingTimerArmed || nRate == 0)
+					return;
+
+				m_bPacingTimerArmed = true;
+				m_PacingTimer.expires_after(PacingDelay());
+				m_PacingTimer.async_wait(
+					make_custom_alloc_handler(m_TimerHandlerMemory, [this](std::error_code ec)
+					{
+						m_bPacingTimerArmed = false;
+						if (!ec && !m_bWritingMessages && HasPendingMessages())
+							WriteMessages();
+					}));
+			}
+
+			// The first "nMessages" of a pending queue have just been written. Messages that
+			// went out whole, or whose last chunk was just sent, are done with
+			void RetireMessages(pending_queue& pending, size_t nMessages)
+			{
+				auto itBatchEnd = pending.begin() + nMessages;
+				for (auto it = pending.begin(); it != itBatchEnd; ++it)
+				{
+					it->nSent += it->nWriting;
+					it->nWriting = 0;
+
+					if (it->nSent >= it->msg.size())
+					{
+						m_nQueuedMessages.fetch_sub(1, std::memory_order_relaxed);
+						m_nQueuedBytes.fetch_sub(QueuedSize(*it), std::memory_order_relaxed);
+					}
+				}
+
+				auto itDone = std::remove_if(pending.begin(), itBatchEnd, [](const outgoing_message& out) { return out.nSent >= out.msg.size(); });
+				pending.erase(itDone, itBatchEnd);
 			}
 
 			// ASYNC - Prime context ready to read a message header
 			void ReadHeader()
 			{
+				if (!FlushParkedMessages())
+				{
+					WaitForIncomingQueue();
+					return;
+				}
+
 				// If this function is called, we are expecting asio to wait until it receives
 				// enough bytes to form a header of a message. We know the headers are a fixed
 				// size, so allocate a transmission buffer large enough to store it. In fact, 
 				// we will construct the message in a "temporary" message object as it's 
 				// convenient to work with.
 				asio::async_read(m_Socket, asio::buffer(&m_MsgTemporaryIn.header, sizeof(message_header<T>)),
-					[this](std::error_code ec, std::size_t length)
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
 							// A complete message header has been read, check if this message
-							// has a body to follow...
-							if (m_MsgTemporaryIn.header.size > 0)
+							// is a chunk of a larger one...
+							if (m_MsgTemporaryIn.header.flags & message_flags::chunk)
 							{
-								// ...it does, so allocate enough space in the messages' body
-								// vector, and issue asio with the task to read the body.
-								m_MsgTemporaryIn.body.resize(m_MsgTemporaryIn.header.size);
+								// ...it is, so find out where the chunk belongs first
+								ReadChunkHeader();
+							}
+							// ...or has a body to follow...
+							else if (m_MsgTemporaryIn.header.size > 0)
+							{
+								// ...it does, so take a buffer large enough for the body from the
+								// pool, and issue asio with the task to read the body straight into it.
+								m_MsgTemporaryIn.body = m_BufferPool.Acquire(m_MsgTemporaryIn.header.size);
 								ReadBody();
 							}
 							else
 							{
 								// it doesn't, so add this bodyless message to the connections
-								// incoming message queue
+								// incoming message queue, and wait for the next one
+								m_MsgTemporaryIn.body.clear();
 								AddToIncomingMessageQueue();
+								ReadHeader();
 							}
 						}
 						else
@@ -226,23 +732,26 @@ namespace rpc
 							std::cout << "[" << m_ID << "] Read Header Fail.\n";
 							m_Socket.close();
 						}
-					});
+					}));
 			}
 
 			// ASYNC - Prime context ready to read a message body
-			void ReadBody()
+			void ReadBody(size_t nOffset = 0)
 			{
 				// If this function is called, a header has already been read, and that header
 				// request we read a body, The space for that body has already been allocated
 				// in the temporary message object, so just wait for the bytes to arrive...
-				asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.body.data(), m_MsgTemporaryIn.body.size()),
-					[this](std::error_code ec, std::size_t length)
+				// (the first "nOffset" bytes may already be there, if the buffered reader
+				// handed this body off half way through)
+				asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.body.data() + nOffset, m_MsgTemporaryIn.body.size() - nOffset),
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
 							// ...and they have! The message is now complete, so add
-							// the whole message to incoming queue
+							// the whole message to incoming queue, and carry on reading
 							AddToIncomingMessageQueue();
+							ReadNext();
 						}
 						else
 						{
@@ -250,46 +759,659 @@ namespace rpc
 							std::cout << "[" << m_ID << "] Read Body Fail.\n";
 							m_Socket.close();
 						}
-					});
+					}));
+			}
+
+			// ASYNC - Prime context ready to read the chunk header that follows the header
+			// of a chunk message
+			void ReadChunkHeader()
+			{
+				asio::async_read(m_Socket, asio::buffer(&m_ChunkIn, sizeof(chunk_header)),
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							size_t nStream = FindStream(m_MsgTemporaryIn.header, m_ChunkIn);
+							if (nStream == InvalidStream)
+							{
+								// The remote sent something that cannot be placed, we cannot
+								// trust anything after it either
+								std::cout << "[" << m_ID << "] Invalid Chunk.\n";
+								m_Socket.close();
+								return;
+							}
+
+							ReadChunkBody(nStream);
+						}
+						else
+						{
+							// As above!
+							std::cout << "[" << m_ID << "] Read Chunk Header Fail.\n";
+							m_Socket.close();
+						}
+					}));
+			}
+
+			// ASYNC - Prime context ready to read the body of a chunk straight into its place in
+			// the buffer of its stream (the first "nOffset" bytes may already be there, if the
+			// buffered reader handed this chunk off half way through)
+			void ReadChunkBody(size_t nStream, size_t nOffset = 0)
+			{
+				uint8_t* pChunk = m_StreamsIn[nStream].msg.body.data() + m_ChunkIn.offset;
+				asio::async_read(m_Socket, asio::buffer(pChunk + nOffset, m_ChunkIn.length - nOffset),
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this, nStream](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							AddChunkToStream(nStream);
+							ReadNext();
+						}
+						else
+						{
+							// As above!
+							std::cout << "[" << m_ID << "] Read Chunk Body Fail.\n";
+							m_Socket.close();
+						}
+					}));
+			}
+
+			// Find the stream a chunk belongs to, starting a new one on its first chunk with a
+			// pooled buffer sized for the whole message. Returns InvalidStream if the chunk
+			// does not fit in any stream
+			size_t FindStream(const message_header<T>& header, const chunk_header& chunk)
+			{
+				if (header.size != sizeof(chunk_header) + chunk.length || chunk.total > MaxStreamSize || chunk.offset + chunk.length > chunk.total)
+					return InvalidStream;
+
+				for (size_t i = 0; i < m_StreamsIn.size(); i++)
+				{
+					if (m_StreamsIn[i].nStream == chunk.stream)
+						return m_StreamsIn[i].msg.body.size() == chunk.total ? i : InvalidStream;
+				}
+
+				// Only the first chunk can start a stream
+				if (chunk.offset != 0)
+					return InvalidStream;
+
+				incoming_stream& stream = m_StreamsIn.emplace_back();
+				stream.nStream = chunk.stream;
+				stream.nReceived = 0;
+				stream.msg.header.id = header.id;
+				stream.msg.header.size = static_cast<uint32_t>(chunk.total);
+				stream.msg.header.flags = 0;
+				stream.msg.body = m_BufferPool.Acquire(chunk.total);
+				return m_StreamsIn.size() - 1;
+			}
+
+			// A whole chunk has landed in its stream, report the progress, and once the last
+			// chunk is in, queue the complete message
+			void AddChunkToStream(size_t nStream)
+			{
+				incoming_stream& stream = m_StreamsIn[nStream];
+				stream.nReceived += m_ChunkIn.length;
+
+				if (m_ProgressHandler)
+				{
+					stream_progress progress;
+					progress.stream = stream.nStream;
+					progress.offset = m_ChunkIn.offset;
+					progress.length = m_ChunkIn.length;
+					progress.received = stream.nReceived;
+					progress.total = m_ChunkIn.total;
+					progress.data = stream.msg.body.data();
+					m_ProgressHandler(GetOwnedPointer(), stream.msg.header, progress);
+				}
+
+				if (stream.nReceived == m_ChunkIn.total)
+				{
+					AddToIncomingMessageQueue(std::move(stream.msg));
+
+					// The order of streams does not matter, so fill the gap with the last one
+					if (nStream != m_StreamsIn.size() - 1)
+						m_StreamsIn[nStream] = std::move(m_StreamsIn.back());
+					m_StreamsIn.pop_back();
+				}
+			}
+
+			// ASYNC - Prime context to read whatever bytes are available into the read buffer
+			void ReadIntoBuffer()
+			{
+				if (!FlushParkedMessages())
+				{
+					WaitForIncomingQueue();
+					return;
+				}
+
+				CompactReadBuffer();
+				m_Socket.async_read_some(asio::buffer(m_ReadBuffer.data() + m_ReadEnd, m_ReadBuffer.size() - m_ReadEnd),
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							m_ReadEnd += length;
+							ParseReadBuffer();
+						}
+						else
+						{
+							// As above!
+							std::cout << "[" << m_ID << "] Read Buffer Fail.\n";
+							m_Socket.close();
+						}
+					}));
+			}
+
+			// Move the bytes of a partially received message to the start of the read
+			// buffer, making as much room as possible after them
+			void CompactReadBuffer()
+			{
+				if (m_ReadBegin == m_ReadEnd)
+				{
+					m_ReadBegin = m_ReadEnd = 0;
+				}
+				else if (m_ReadBegin > 0)
+				{
+					std::memmove(m_ReadBuffer.data(), m_ReadBuffer.data() + m_ReadBegin, m_ReadEnd - m_ReadBegin);
+					m_ReadEnd -= m_ReadBegin;
+					m_ReadBegin = 0;
+				}
+			}
+
+			// Split as many complete messages as possible out of the read buffer, then
+			// go back to reading
+			void ParseReadBuffer()
+			{
+				size_t nStream = 0, nOffset = 0;
+				switch (SplitReadBuffer(nStream, nOffset))
+				{
+				case buffered_read::body:
+					ReadBody(nOffset);
+					break;
+				case buffered_read::chunk:
+					ReadChunkBody(nStream, nOffset);
+					break;
+				case buffered_read::invalid:
+					// The remote sent something that cannot be placed, we cannot
+					// trust anything after it either
+					std::cout << "[" << m_ID << "] Invalid Chunk.\n";
+					m_Socket.close();
+					break;
+				default:
+					ReadIntoBuffer();
+					break;
+				}
+			}
+
+			// Queue every complete message in the read buffer, and tell what to read next.
+			// A large body, or chunk of stream "nStreamOut", still arriving is read straight
+			// into its own buffer, of which the first "nOffset" bytes are already there
+			buffered_read SplitReadBuffer(size_t& nStreamOut, size_t& nOffset)
+			{
+				while (m_ReadEnd - m_ReadBegin >= sizeof(message_header<T>))
+				{
+					const uint8_t* pData = m_ReadBuffer.data() + m_ReadBegin;
+					size_t nBodyAvailable = m_ReadEnd - m_ReadBegin - sizeof(message_header<T>);
+
+					message_header<T> header;
+					std::memcpy(&header, pData, sizeof(message_header<T>));
+
+					if (header.flags & message_flags::chunk)
+					{
+						// A chunk of a larger message, nothing can be done with it until its
+						// chunk header is in
+						if (nBodyAvailable < sizeof(chunk_header))
+							break;
+
+						m_MsgTemporaryIn.header = header;
+						std::memcpy(&m_ChunkIn, pData + sizeof(message_header<T>), sizeof(chunk_header));
+
+						size_t nStream = FindStream(header, m_ChunkIn);
+						if (nStream == InvalidStream)
+						{
+							return buffered_read::invalid;
+						}
+
+						// Copy what we have of the chunk into its place in the stream...
+						const uint8_t* pChunk = pData + sizeof(message_header<T>) + sizeof(chunk_header);
+						size_t nChunkAvailable = std::min<size_t>(m_ChunkIn.length, nBodyAvailable - sizeof(chunk_header));
+						std::memcpy(m_StreamsIn[nStream].msg.body.data() + m_ChunkIn.offset, pChunk, nChunkAvailable);
+
+						if (nChunkAvailable == m_ChunkIn.length)
+						{
+							m_ReadBegin += sizeof(message_header<T>) + header.size;
+							AddChunkToStream(nStream);
+						}
+						else
+						{
+							// ...and if it is not all there yet, read the rest straight into it
+							m_ReadBegin = m_ReadEnd = 0;
+							nStreamOut = nStream;
+							nOffset = nChunkAvailable;
+							return buffered_read::chunk;
+						}
+					}
+					else if (header.size <= nBodyAvailable)
+					{
+						// The whole message is in the buffer, copy its body out into a pooled
+						// buffer and queue it
+						m_MsgTemporaryIn.header = header;
+						if (header.size > 0)
+						{
+							m_MsgTemporaryIn.body = m_BufferPool.Acquire(header.size);
+							std::memcpy(m_MsgTemporaryIn.body.data(), pData + sizeof(message_header<T>), header.size);
+						}
+						else
+						{
+							m_MsgTemporaryIn.body.clear();
+						}
+
+						m_ReadBegin += sizeof(message_header<T>) + header.size;
+						AddToIncomingMessageQueue();
+					}
+					else if (header.size >= LargeBodySize)
+					{
+						// A large body is still arriving. Rather than pulling it through the
+						// read buffer, move the part we already have into its pooled buffer
+						// and let asio read the rest straight into it
+						m_MsgTemporaryIn.header = header;
+						m_MsgTemporaryIn.body = m_BufferPool.Acquire(header.size);
+						std::memcpy(m_MsgTemporaryIn.body.data(), pData + sizeof(message_header<T>), nBodyAvailable);
+
+						m_ReadBegin = m_ReadEnd = 0;
+						nOffset = nBodyAvailable;
+						return buffered_read::body;
+					}
+					else
+					{
+						// A small message is incomplete, wait for the rest of it
+						break;
+					}
+				}
+
+				return buffered_read::more;
+			}
+
+			// Once connected, start reading, and writing whatever was sent meanwhile
+			void StartTransfer()
+			{
+				m_bTransferring = true;
+#if defined(RPC_NET_COROUTINES)
+				asio::co_spawn(m_Socket.get_executor(), ReadLoop(), asio::detached);
+				asio::co_spawn(m_Socket.get_executor(), WriteLoop(), asio::detached);
+#else
+				ReadNext();
+				if (!m_bWritingMessages && HasPendingMessages())
+					WriteMessages();
+#endif
+			}
+
+#if defined(RPC_NET_COROUTINES)
+			// The coroutine version of the read chain, a single coroutine reads for the
+			// whole life of the connection. Its frame is allocated once, and each awaited
+			// read reuses asio's per-thread recycled handler memory
+			awaitable ReadLoop()
+			{
+				// Server side connections are shared, this one stays alive while reading
+				std::shared_ptr<connection<T>> self = this->weak_from_this().lock();
+
+				asio::error_code ec;
+				bool bInvalid = false;
+				while (!ec && !bInvalid)
+				{
+					// Nothing more is read while the incoming queue is full
+					if (!FlushParkedMessages())
+					{
+						m_IncomingTimer.expires_after(IncomingQueueRetry);
+						co_await m_IncomingTimer.async_wait(asio::redirect_error(use_awaitable, ec));
+						continue;
+					}
+
+					if (m_ReadMode == read_mode::buffered)
+					{
+						size_t nStream = 0, nOffset = 0;
+						switch (SplitReadBuffer(nStream, nOffset))
+						{
+						case buffered_read::body:
+							co_await asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.body.data() + nOffset, m_MsgTemporaryIn.body.size() - nOffset), asio::redirect_error(use_awaitable, ec));
+							if (!ec)
+								AddToIncomingMessageQueue();
+							break;
+						case buffered_read::chunk:
+							co_await asio::async_read(m_Socket, asio::buffer(m_StreamsIn[nStream].msg.body.data() + m_ChunkIn.offset + nOffset, m_ChunkIn.length - nOffset), asio::redirect_error(use_awaitable, ec));
+							if (!ec)
+								AddChunkToStream(nStream);
+							break;
+						case buffered_read::invalid:
+							bInvalid = true;
+							break;
+						default:
+							CompactReadBuffer();
+							m_ReadEnd += co_await m_Socket.async_read_some(asio::buffer(m_ReadBuffer.data() + m_ReadEnd, m_ReadBuffer.size() - m_ReadEnd), asio::redirect_error(use_awaitable, ec));
+							break;
+						}
+						continue;
+					}
+
+					// Exact reads, the header first...
+					co_await asio::async_read(m_Socket, asio::buffer(&m_MsgTemporaryIn.header, sizeof(message_header<T>)), asio::redirect_error(use_awaitable, ec));
+					if (ec)
+						break;
+
+					if (m_MsgTemporaryIn.header.flags & message_flags::chunk)
+					{
+						// ...then where a chunk belongs, and the chunk straight into its place...
+						co_await asio::async_read(m_Socket, asio::buffer(&m_ChunkIn, sizeof(chunk_header)), asio::redirect_error(use_awaitable, ec));
+						if (ec)
+							break;
+
+						size_t nStream = FindStream(m_MsgTemporaryIn.header, m_ChunkIn);
+						if (nStream == InvalidStream)
+						{
+							bInvalid = true;
+							break;
+						}
+
+						co_await asio::async_read(m_Socket, asio::buffer(m_StreamsIn[nStream].msg.body.data() + m_ChunkIn.offset, m_ChunkIn.length), asio::redirect_error(use_awaitable, ec));
+						if (!ec)
+							AddChunkToStream(nStream);
+					}
+					else if (m_MsgTemporaryIn.header.size > 0)
+					{
+						// ...or the body into a pooled buffer...
+						m_MsgTemporaryIn.body = m_BufferPool.Acquire(m_MsgTemporaryIn.header.size);
+						co_await asio::async_read(m_Socket, asio::buffer(m_MsgTemporaryIn.body.data(), m_MsgTemporaryIn.body.size()), asio::redirect_error(use_awaitable, ec));
+						if (!ec)
+							AddToIncomingMessageQueue();
+					}
+					else
+					{
+						// ...or nothing more, for a bodyless message
+						m_MsgTemporaryIn.body.clear();
+						AddToIncomingMessageQueue();
+					}
+				}
+
+				// Most likely a disconnect, close the socket and let the system tidy it up
+				if (bInvalid)
+					std::cout << "[" << m_ID << "] Invalid Chunk.\n";
+				else
+					std::cout << "[" << m_ID << "] Read Fail.\n";
+				m_Socket.close();
+				m_WriteSignal.cancel();
+			}
+
+			// The coroutine version of the write chain. It writes while there is anything
+			// to write, and otherwise waits on the signal timer, which a drain cancels when
+			// it finds something, or which expires when the pacer is out of debt
+			awaitable WriteLoop()
+			{
+				std::shared_ptr<connection<T>> self = this->weak_from_this().lock();
+
+				asio::error_code ec;
+				while (IsConnected())
+				{
+					if (!GatherPendingMessages())
+					{
+						if (HasPendingMessages())
+							m_WriteSignal.expires_after(PacingDelay());
+						else
+							m_WriteSignal.expires_at(std::chrono::steady_clock::time_point::max());
+						co_await m_WriteSignal.async_wait(asio::redirect_error(use_awaitable, ec));
+						continue;
+					}
+
+					m_bWritingMessages = true;
+					co_await asio::async_write(m_Socket, std::span<const asio::const_buffer>(m_WriteBuffers), asio::redirect_error(use_awaitable, ec));
+					if (ec)
+					{
+						std::cout << "[" << m_ID << "] Write Messages Fail.\n";
+						m_Socket.close();
+						break;
+					}
+
+					for (size_t i = 0; i < m_MessagesPending.size(); i++)
+						RetireMessages(m_MessagesPending[i], m_BatchSizes[i]);
+					m_bWritingMessages = false;
+				}
+			}
+#endif
+
+			// Prime the context to read the next message, in whichever way this
+			// connection reads
+			void ReadNext()
+			{
+				if (m_ReadMode == read_mode::buffered)
+					ParseReadBuffer();
+				else
+					ReadHeader();
 			}
 
 			// Once a full message is received, add it to the incoming queue
 			void AddToIncomingMessageQueue()
 			{
+				AddToIncomingMessageQueue(std::move(m_MsgTemporaryIn));
+			}
+
+			void AddToIncomingMessageQueue(message<T>&& msg)
+			{
+				// Session handshake messages are for the network layer only
+				if (msg.header.flags & message_flags::session)
+				{
+					if (m_SessionHandler)
+						m_SessionHandler(*this, msg);
+					m_BufferPool.Release(std::move(msg.body));
+					return;
+				}
+
+				// A bulk lane whose primary connection has gone has no one to deliver to
+				std::shared_ptr<connection<T>> remote = GetOwnedPointer();
+				if (m_OwnerType == owner::server && !remote)
+				{
+					m_BufferPool.Release(std::move(msg.body));
+					return;
+				}
+
 				// Shove it in queue, converting it to an "owned message", by initialising
-				// with the a shared pointer from this connection object
-				if (m_OwnerType == owner::server)
-					m_MessagesIn.push_back({ this->shared_from_this(), m_MsgTemporaryIn });
-				else
-					m_MessagesIn.push_back({ nullptr, m_MsgTemporaryIn });
+				// with the a shared pointer from this connection object. The message is
+				// moved, so its pooled body now belongs to the queue until it is handled.
+				// Nothing on a stream may be lost, if the application falls behind and
+				// the queue is full the message is parked here, and reading stops until
+				// it is in, so the remote is held back by TCP instead
+				owned_message<T> owned{ std::move(remote), std::move(msg) };
+				if (m_MessagesParked.empty() && m_MessagesIn.try_push(std::move(owned)))
+					return;
 
-				// We must now prime the asio context to receive the next message. It 
-				// wil just sit and wait for bytes to arrive, and the message construction
+				// Parked without its owner, a connection holding a pointer to itself would
+				// never go away
+				owned.remote.reset();
+				m_MessagesParked.push_back(std::move(owned));
+
+				// The caller must now prime the asio context to receive the next message.
+				// It will just sit and wait for bytes to arrive, and the message construction
 				// process repeats itself. Clever huh?
-				ReadHeader();
+			}
+
+			// Move parked messages into the incoming queue, in order, as long as it has
+			// room. Returns true once none are left
+			bool FlushParkedMessages()
+			{
+				while (!m_MessagesParked.empty())
+				{
+					owned_message<T>& owned = m_MessagesParked.front();
+					owned.remote = GetOwnedPointer();
+					if (m_OwnerType == owner::server && !owned.remote)
+						m_BufferPool.Release(std::move(owned.msg.body));
+					else if (!m_MessagesIn.try_push(std::move(owned)))
+					{
+						owned.remote.reset();
+						return false;
+					}
+					m_MessagesParked.pop_front();
+				}
+				return true;
+			}
+
+			// ASYNC - The incoming queue is full, look again shortly and carry on reading
+			// once the parked messages are in
+			void WaitForIncomingQueue()
+			{
+				m_IncomingTimer.expires_after(IncomingQueueRetry);
+				m_IncomingTimer.async_wait(
+					make_custom_alloc_handler(m_ReadHandlerMemory, [this](std::error_code ec)
+					{
+						if (!ec)
+							ReadNext();
+					}));
+			}
+
+			// Messages are "owned" by their connection on the server side only, what
+			// arrives on a bulk lane is owned by its primary connection
+			std::shared_ptr<connection<T>> GetOwnedPointer()
+			{
+				if (m_OwnerType == owner::server)
+					return m_bIsBulkLane ? m_Primary.lock() : this->shared_from_this();
+				else
+					return nullptr;
 			}
 
 		protected:
+			// Memory for the handlers of the read and the write in flight, of the posted
+			// drain and of the pacing timer, there is never more than one of each. Declared
+			// before the socket, so it outlives any operation the socket still holds
+			handler_memory m_ReadHandlerMemory;
+			handler_memory m_WriteHandlerMemory;
+			handler_memory m_DrainHandlerMemory;
+			handler_memory m_TimerHandlerMemory;
+
 			// Each connection has a unique socket to a remote 
-			asio::ip::tcp::socket m_Socket;
+			socket_type m_Socket;
 
 			// This context is shared with the whole asio instance
 			asio::io_context& m_AsioContext;
 
 			// This queue holds all messages to be sent to the remote side
-			// of this connection
-			tsdeque<message<T>> m_MessagesOut;
+			// of this connection. Any thread may push into it, only the asio
+			// context takes messages out. Bodies are shared, so a message
+			// broadcast to many connections exists only once in memory
+			mpsc_queue<outgoing_message> m_MessagesOut{ MaxQueuedMessages };
+			static constexpr size_t MaxQueuedMessages = 1024;
+
+			// Messages taken out of the outgoing queue, waiting to be (or being)
+			// written, one queue per priority. Only ever touched from within the
+			// asio context. The write in flight covers the first m_BatchSizes
+			// messages of each queue
+			std::array<pending_queue, 3> m_MessagesPending;
+			std::array<size_t, 3> m_BatchSizes = {};
+			bool m_bWritingMessages = false;
+			// Set once connected, nothing is written before
+			bool m_bTransferring = false;
+
+			// Connecting, see ConnectToServer. The connector is only touched from within
+			// the asio context once started
+			std::shared_ptr<connector> m_Connector;
+			std::atomic<bool> m_bConnecting = false;
+			std::function<void()> m_OnConnect;
+			connect_handler m_ConnectHandler;
+			std::chrono::milliseconds m_ConnectAttemptTimeout = std::chrono::seconds(2);
+			std::chrono::milliseconds m_ConnectTimeout = std::chrono::seconds(5);
+
+			// Bodies larger than this are sent in chunks, each chunk starting a
+			// new stream on the remote side
+			size_t m_ChunkSize = DefaultChunkSize;
+			uint32_t m_NextStreamID = 0;
+			static constexpr size_t DefaultChunkSize = 64 * 1024;
+
+			// Pacing of bulk messages, see SetPacingRate. The token bucket and its timer
+			// are only touched from within the asio context
+			std::atomic<size_t> m_nPacingRate = 0;
+			std::atomic<size_t> m_nPacingSlice = DefaultPacingSlice;
+			double m_PacingTokens = 0.0;
+			std::chrono::steady_clock::time_point m_PacingRefill;
+			timer_type m_PacingTimer;
+			bool m_bPacingTimerArmed = false;
+
+#if defined(RPC_NET_COROUTINES)
+			// The write loop waits on this when there is nothing it may write
+			timer_type m_WriteSignal{ m_Socket.get_executor() };
+#endif
+			static constexpr size_t DefaultPacingSlice = 16 * 1024;
+
+			// Set while a drain of the outgoing queue is posted to the asio context
+			std::atomic<bool> m_bDrainPending = false;
+
+			// Message types where only the latest unsent message is worth sending
+			std::vector<T> m_SupersedingIDs;
+
+			// Everything sent but not yet written, for the owner to apply backpressure
+			std::atomic<size_t> m_nQueuedMessages = 0;
+			std::atomic<size_t> m_nQueuedBytes = 0;
+			std::atomic<size_t> m_nSupersededMessages = 0;
+
+			// Scatter/gather buffers describing the messages currently being written,
+			// kept around so their storage is reused from one write to the next
+			std::vector<asio::const_buffer> m_WriteBuffers;
+
+			// Most buffers the operating system accepts in one vectored write (IOV_MAX
+			// is far larger, but asio never passes more than 64 buffers to writev)
+			static constexpr size_t MaxWriteBuffers = 64;
 
 			// This references the incoming queue of the parent object
-			tsdeque<owned_message<T>>& m_MessagesIn;
+			mpsc_queue<owned_message<T>>& m_MessagesIn;
+
+			// Messages the incoming queue had no room for, held back in order, and the
+			// timer that looks for room again. Only touched from within the asio context
+			std::deque<owned_message<T>> m_MessagesParked;
+			timer_type m_IncomingTimer{ m_Socket.get_executor() };
+			static constexpr std::chrono::milliseconds IncomingQueueRetry{ 1 };
+
+			// This references the pool of the parent object, incoming bodies are read
+			// into its buffers and given back to it once they have been handled
+			buffer_pool& m_BufferPool;
 
 			// Incoming messages are constructed asynchronously, so we will
 			// store the part assembled message here, until it is ready
 			message<T> m_MsgTemporaryIn;
 
+			// Large messages arrive as a stream of chunks, each stream is put back
+			// together in a buffer sized for the whole message
+			struct incoming_stream
+			{
+				uint32_t nStream = 0;
+				uint64_t nReceived = 0;
+				message<T> msg;
+			};
+
+			std::vector<incoming_stream> m_StreamsIn;
+			chunk_header m_ChunkIn;
+			progress_handler m_ProgressHandler;
+
+			// Session mode, see session_step. A primary connection may have a bulk lane,
+			// which sends its bulk messages, and a bulk lane knows its primary connection
+			session_handler m_SessionHandler;
+			std::atomic<std::shared_ptr<connection<T>>> m_BulkLane;
+			std::weak_ptr<connection<T>> m_Primary;
+			bool m_bIsBulkLane = false;
+
+			// Streams larger than this are refused, rather than trusting the remote
+			// with how much we allocate
+			static constexpr uint64_t MaxStreamSize = 256 * 1024 * 1024;
+			static constexpr size_t InvalidStream = size_t(-1);
+
 			// The "owner" decides how some of the connection behaves
 			owner m_OwnerType = owner::server;
 
+			// When reading in buffered mode, raw bytes land in this buffer first, and
+			// the messages they hold are split out of the range [m_ReadBegin, m_ReadEnd)
+			read_mode m_ReadMode = read_mode::exact;
+			std::vector<uint8_t> m_ReadBuffer;
+			size_t m_ReadBegin = 0;
+			size_t m_ReadEnd = 0;
+
+			// Size of the buffered mode read buffer, and the body size from which a
+			// partially received body is read straight into its own buffer instead.
+			// Anything smaller always fits in the buffer, next to an incomplete header
+			static constexpr size_t ReadBufferSize = 64 * 1024;
+			static constexpr size_t LargeBodySize = ReadBufferSize / 4;
+
 			uint32_t m_ID = 0;
 		};
 	}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_connection.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// The server's set of validated connections, keyed by connection ID. Connections
+		// are added from the asio threads as clients are accepted, and looked up, walked
+		// and removed from the thread running the server's update, all at the same time.
+		//
+		// Broadcasting walks a snapshot: an immutable list of the connections, rebuilt only
+		// when one is added or removed. Taking it costs a reference count, so a client
+		// coming or going never holds up a broadcast for more than that.
+		template<typename T>
+		class connection_registry
+		{
+		public:
+			using connection_list = std::vector<std::shared_ptr<connection<T>>>;
+
+		public:
+			connection_registry() = default;
+			connection_registry(const connection_registry<T>&) = delete;
+
+		public:
+			// Register a connection under the ID it is given
+			void Add(uint32_t nID, std::shared_ptr<connection<T>> client)
+			{
+				std::unique_lock lock(m_Mutex);
+				m_Connections[nID] = std::move(client);
+				RebuildSnapshot();
+			}
+
+			// Forget a connection, returns it if it was still registered. Only one of
+			// several threads removing the same connection gets it back
+			std::shared_ptr<connection<T>> Remove(uint32_t nID)
+			{
+				std::unique_lock lock(m_Mutex);
+				auto it = m_Connections.find(nID);
+				if (it == m_Connections.end())
+					return nullptr;
+
+				std::shared_ptr<connection<T>> client = std::move(it->second);
+				m_Connections.erase(it);
+				RebuildSnapshot();
+				return client;
+			}
+
+			std::shared_ptr<connection<T>> Find(uint32_t nID) const
+			{
+				std::shared_lock lock(m_Mutex);
+				auto it = m_Connections.find(nID);
+				return it != m_Connections.end() ? it->second : nullptr;
+			}
+
+			// Every connection registered right now, the list never changes once taken
+			std::shared_ptr<const connection_list> Snapshot() const
+			{
+				std::shared_lock lock(m_Mutex);
+				return m_Snapshot;
+			}
+
+			size_t Count() const
+			{
+				std::shared_lock lock(m_Mutex);
+				return m_Connections.size();
+			}
+
+			void Clear()
+			{
+				std::unique_lock lock(m_Mutex);
+				m_Connections.clear();
+				RebuildSnapshot();
+			}
+
+		private:
+			// Connects and disconnects are rare next to broadcasts, so the snapshot is
+			// rebuilt on every change instead of being patched. Lists already handed out
+			// stay valid, they are freed with their last holder
+			void RebuildSnapshot()
+			{
+				auto snapshot = std::make_shared<connection_list>();
+				snapshot->reserve(m_Connections.size());
+				for (auto& [nID, client] : m_Connections)
+					snapshot->push_back(client);
+				m_Snapshot = std::move(snapshot);
+			}
+
+		private:
+			mutable std::shared_mutex m_Mutex;
+			std::unordered_map<uint32_t, std::shared_ptr<connection<T>>> m_Connections;
+			std::shared_ptr<const connection_list> m_Snapshot = std::make_shared<connection_list>();
+		};
+	}
+}
\ No newline at end of file
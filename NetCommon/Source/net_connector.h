@@ -0,0 +1,376 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// What a connect is up to, as told to the connect handler
+		enum class connect_status : uint8_t
+		{
+			// Looking the host name up, only for names that are not an address already
+			resolving,
+			// Trying one endpoint, others may be tried alongside it
+			attempting,
+			// That endpoint refused, or did not answer in time
+			attempt_failed,
+			// The first endpoint to answer won, the other attempts were dropped
+			connected,
+			// Nothing answered before the deadline, or the name did not resolve
+			failed
+		};
+
+		// Called from within the connection's strand each time the connect moves on. The
+		// endpoint is empty for "resolving" and "failed", the error is only set on failures
+		using connect_handler = std::function<void(connect_status, const asio::ip::tcp::endpoint&, const asio::error_code&)>;
+
+		// Connects a socket without ever blocking the thread that asked for it, and within
+		// a bounded time whatever the network does.
+		//
+		// The host name is looked up on a thread of its own, the lookup of the operating
+		// system cannot be cancelled and may take its time, the connector simply stops
+		// waiting for it at the deadline. Only a few lookups run at once in the process.
+		// The endpoints it gives are then raced (Happy Eyeballs, RFC 8305): IPv6 and IPv4
+		// take turns, a new attempt starts every 250ms, or as soon as the previous one
+		// fails, while the earlier ones keep going. The
+		// first to connect wins and the others are closed. Each attempt gives up after
+		// its own timeout, and the whole connect after the total one, so a black holed
+		// SYN or a dead DNS server costs at most that long
+		class connector : public std::enable_shared_from_this<connector>
+		{
+		public:
+			// The same socket and timer types as the connection, everything runs on its strand
+			using strand_type = asio::strand<asio::io_context::executor_type>;
+			using socket_type = asio::basic_stream_socket<asio::ip::tcp, strand_type>;
+			using timer_type = asio::basic_waitable_timer<std::chrono::steady_clock, asio::wait_traits<std::chrono::steady_clock>, strand_type>;
+
+			// Called from within the strand with the socket that won, to be moved away
+			using connected_handler = std::function<void(socket_type&)>;
+
+			connector(strand_type strand, std::chrono::milliseconds attemptTimeout, std::chrono::milliseconds totalTimeout, connect_handler onStatus)
+				: m_Strand(strand), m_Deadline(strand), m_NextAttempt(strand), m_AttemptTimeout(attemptTimeout), m_TotalTimeout(totalTimeout), m_Resolve(std::make_shared<resolve_request>()), m_OnStatus(std::move(onStatus))
+			{
+			}
+
+		public:
+			// Look "host" up, then race the endpoints it resolves to. Returns at once
+			void Start(const std::string& host, uint16_t port, connected_handler onConnected)
+			{
+				asio::dispatch(m_Strand,
+					[self = this->shared_from_this(), host, port, onConnected = std::move(onConnected)]() mutable
+					{
+						self->m_OnConnected = std::move(onConnected);
+						self->StartDeadline();
+
+						// An address needs no lookup
+						asio::error_code ec;
+						asio::ip::address address = asio::ip::make_address(host, ec);
+						if (!ec)
+							self->Race({ asio::ip::tcp::endpoint(address, port) });
+						else
+							self->Resolve(host, port);
+					});
+			}
+
+			// Race endpoints known already. Returns at once
+			void Start(std::vector<asio::ip::tcp::endpoint> endpoints, connected_handler onConnected)
+			{
+				asio::dispatch(m_Strand,
+					[self = this->shared_from_this(), endpoints = std::move(endpoints), onConnected = std::move(onConnected)]() mutable
+					{
+						self->m_OnConnected = std::move(onConnected);
+						self->StartDeadline();
+						self->Race(std::move(endpoints));
+					});
+			}
+
+			// Give up, without telling anyone. Must be called from within the strand
+			void Cancel()
+			{
+				m_OnConnected = nullptr;
+				m_OnStatus = nullptr;
+				Finish(asio::error::operation_aborted, nullptr);
+			}
+
+			// Stop a lookup still running from handing anything over. Any thread may call
+			// this, and must before the context goes if the strand might never run Cancel
+			void Abandon()
+			{
+				std::lock_guard<std::mutex> lock(m_Resolve->mutex);
+				m_Resolve->handler = nullptr;
+				m_Resolve->strand.reset();
+			}
+
+		private:
+			// One endpoint being tried
+			struct attempt
+			{
+				attempt(strand_type strand, const asio::ip::tcp::endpoint& remote)
+					: socket(strand), deadline(strand), endpoint(remote)
+				{
+				}
+
+				socket_type socket;
+				timer_type deadline;
+				asio::ip::tcp::endpoint endpoint;
+				bool bDone = false;
+				bool bTimedOut = false;
+			};
+
+			// A lookup running on its own thread. The strand is its only way back and is
+			// only used, or let go of, under the lock. It is cleared the moment nobody
+			// wants the result, so the thread never touches a context that is gone
+			struct resolve_request
+			{
+				std::mutex mutex;
+				std::optional<strand_type> strand;
+				std::function<void(asio::error_code, std::vector<asio::ip::tcp::endpoint>)> handler;
+			};
+
+			void StartDeadline()
+			{
+				m_Deadline.expires_after(m_TotalTimeout);
+				m_Deadline.async_wait(
+					[self = this->shared_from_this()](asio::error_code ec)
+					{
+						if (!ec)
+							self->Finish(asio::error::timed_out, nullptr);
+					});
+			}
+
+			void Resolve(const std::string& host, uint16_t port)
+			{
+				Report(connect_status::resolving, asio::ip::tcp::endpoint(), asio::error_code());
+
+				// A lookup stuck on a dead DNS server keeps its thread well past the deadline.
+				// Reconnecting in a loop would pile them up, past a few the connect fails
+				// at once and is tried again later
+				if (s_nLookups.fetch_add(1) >= MaxLookups)
+				{
+					s_nLookups--;
+					Finish(asio::error::try_again, nullptr);
+					return;
+				}
+
+				std::lock_guard<std::mutex> lock(m_Resolve->mutex);
+				m_Resolve->strand = m_Strand;
+				m_Resolve->handler = [self = this->shared_from_this()](asio::error_code ec, std::vector<asio::ip::tcp::endpoint> endpoints)
+				{
+					if (self->m_bFinished)
+						return;
+
+					if (!ec && endpoints.empty())
+						ec = asio::error::host_not_found;
+
+					if (ec)
+						self->Finish(ec, nullptr);
+					else
+						self->Race(std::move(endpoints));
+				};
+
+				std::thread(
+					[request = m_Resolve, host, port]()
+					{
+						asio::io_context context;
+						asio::ip::tcp::resolver resolver(context);
+						asio::error_code ec;
+						asio::ip::tcp::resolver::results_type results = resolver.resolve(host, std::to_string(port), ec);
+
+						std::vector<asio::ip::tcp::endpoint> endpoints;
+						for (const auto& result : results)
+							endpoints.push_back(result.endpoint());
+
+						std::lock_guard<std::mutex> lock(request->mutex);
+						if (request->strand && request->handler)
+						{
+							asio::post(*request->strand,
+								[handler = std::move(request->handler), ec, endpoints = std::move(endpoints)]() mutable
+								{
+									handler(ec, std::move(endpoints));
+								});
+							request->handler = nullptr;
+							request->strand.reset();
+						}
+						s_nLookups--;
+					}).detach();
+			}
+
+			void Race(std::vector<asio::ip::tcp::endpoint> endpoints)
+			{
+				if (m_bFinished)
+					return;
+
+				if (endpoints.empty())
+				{
+					Finish(asio::error::host_not_found, nullptr);
+					return;
+				}
+
+				m_Endpoints = Interleave(std::move(endpoints));
+				StartAttempt();
+			}
+
+			// Try the next endpoint, and schedule the one after it in case this one hangs
+			void StartAttempt()
+			{
+				if (m_bFinished || m_nNextEndpoint >= m_Endpoints.size())
+					return;
+
+				size_t nAttempt = m_Attempts.size();
+				m_Attempts.push_back(std::make_unique<attempt>(m_Strand, m_Endpoints[m_nNextEndpoint++]));
+				attempt& current = *m_Attempts.back();
+				m_nActive++;
+
+				Report(connect_status::attempting, current.endpoint, asio::error_code());
+
+				current.socket.async_connect(current.endpoint,
+					[self = this->shared_from_this(), nAttempt](asio::error_code ec)
+					{
+						self->OnAttempt(nAttempt, ec);
+					});
+
+				current.deadline.expires_after(m_AttemptTimeout);
+				current.deadline.async_wait(
+					[self = this->shared_from_this(), nAttempt](asio::error_code ec)
+					{
+						attempt& timedOut = *self->m_Attempts[nAttempt];
+						if (ec || timedOut.bDone)
+							return;
+
+						// Closing the socket completes the connect with an error
+						timedOut.bTimedOut = true;
+						asio::error_code ignored;
+						timedOut.socket.close(ignored);
+					});
+
+				m_NextAttempt.expires_after(AttemptDelay);
+				m_NextAttempt.async_wait(
+					[self = this->shared_from_this()](asio::error_code ec)
+					{
+						if (!ec)
+							self->StartAttempt();
+					});
+			}
+
+			void OnAttempt(size_t nAttempt, asio::error_code ec)
+			{
+				attempt& done = *m_Attempts[nAttempt];
+				done.bDone = true;
+				done.deadline.cancel();
+				m_nActive--;
+
+				// Lost the race, Finish has closed the socket already
+				if (m_bFinished)
+					return;
+
+				if (!ec)
+				{
+					Finish(asio::error_code(), &done);
+					return;
+				}
+
+				if (done.bTimedOut)
+					ec = asio::error::timed_out;
+				m_LastError = ec;
+				Report(connect_status::attempt_failed, done.endpoint, ec);
+
+				// No point waiting out the delay for the next endpoint
+				if (m_nNextEndpoint < m_Endpoints.size())
+					StartAttempt();
+				else if (m_nActive == 0)
+					Finish(m_LastError, nullptr);
+			}
+
+			// Hand the winner over, or report the failure, and drop everything else
+			void Finish(asio::error_code ec, attempt* pWinner)
+			{
+				if (m_bFinished)
+					return;
+				m_bFinished = true;
+
+				m_Deadline.cancel();
+				m_NextAttempt.cancel();
+
+				Abandon();
+
+				for (std::unique_ptr<attempt>& other : m_Attempts)
+				{
+					if (other.get() == pWinner)
+						continue;
+					other->deadline.cancel();
+					asio::error_code ignored;
+					other->socket.close(ignored);
+				}
+
+				if (pWinner)
+				{
+					if (m_OnConnected)
+						m_OnConnected(pWinner->socket);
+					Report(connect_status::connected, pWinner->endpoint, asio::error_code());
+				}
+				else
+					Report(connect_status::failed, asio::ip::tcp::endpoint(), ec);
+
+				m_OnConnected = nullptr;
+				m_OnStatus = nullptr;
+			}
+
+			void Report(connect_status status, const asio::ip::tcp::endpoint& endpoint, const asio::error_code& ec)
+			{
+				if (m_OnStatus)
+					m_OnStatus(status, endpoint, ec);
+			}
+
+			// Alternate address families, starting with the family of the first endpoint.
+			// A host with a broken IPv6 route then costs one attempt delay, not one attempt
+			// timeout per IPv6 address
+			static std::vector<asio::ip::tcp::endpoint> Interleave(std::vector<asio::ip::tcp::endpoint> endpoints)
+			{
+				if (endpoints.empty())
+					return endpoints;
+
+				bool bV6First = endpoints.front().address().is_v6();
+				std::vector<asio::ip::tcp::endpoint> first, second;
+				for (const asio::ip::tcp::endpoint& endpoint : endpoints)
+					(endpoint.address().is_v6() == bV6First ? first : second).push_back(endpoint);
+
+				std::vector<asio::ip::tcp::endpoint> interleaved;
+				interleaved.reserve(endpoints.size());
+				for (size_t i = 0; i < std::max(first.size(), second.size()); i++)
+				{
+					if (i < first.size())
+						interleaved.push_back(first[i]);
+					if (i < second.size())
+						interleaved.push_back(second[i]);
+				}
+				return interleaved;
+			}
+
+		private:
+			strand_type m_Strand;
+			// Whole connect, and the delay before racing the next endpoint
+			timer_type m_Deadline;
+			timer_type m_NextAttempt;
+			std::chrono::milliseconds m_AttemptTimeout;
+			std::chrono::milliseconds m_TotalTimeout;
+			static constexpr std::chrono::milliseconds AttemptDelay{ 250 };
+
+			// Lookups still running, from every connector in the process
+			static constexpr size_t MaxLookups = 4;
+			static inline std::atomic<size_t> s_nLookups{ 0 };
+
+			std::vector<asio::ip::tcp::endpoint> m_Endpoints;
+			size_t m_nNextEndpoint = 0;
+			std::vector<std::unique_ptr<attempt>> m_Attempts;
+			size_t m_nActive = 0;
+			asio::error_code m_LastError;
+			bool m_bFinished = false;
+
+			// Shared with the lookup thread, which may outlive the connector
+			const std::shared_ptr<resolve_request> m_Resolve;
+			connected_handler m_OnConnected;
+			connect_handler m_OnStatus;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,518 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_buffer_pool.h"
+#include "net_handler_alloc.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// Messages where a late copy is worthless, like frames, can be sent as UDP datagrams
+		// next to a session's TCP connections. A message is cut into fragments, one per
+		// datagram, and after every "groupSize" data fragments comes a parity fragment,
+		// the XOR of the group, so any one fragment lost from a group can be rebuilt. A
+		// message missing more than that is simply dropped, nothing is ever retransmitted.
+		//
+		// Every datagram starts with this header
+		template<typename T>
+		struct datagram_header
+		{
+			// Session token of the sender, ties the datagram to its connection
+			uint64_t token = 0;
+			// Sequence number of the message the datagram is part of
+			uint32_t frame = 0;
+			// Size of the whole message body
+			uint32_t size = 0;
+			T id = {};
+			// Fragments [0, dataCount) carry the body, the ones after carry parity
+			uint16_t index = 0;
+			uint16_t dataCount = 0;
+			// One parity fragment per this many data fragments, zero for none
+			uint16_t groupSize = 0;
+		};
+
+		// Largest fragment carried by a datagram, small enough that a datagram never
+		// needs to be split by IP on an ethernet link
+		static constexpr size_t DatagramFragmentSize = 1200;
+
+		struct datagram_stats
+		{
+			// Sender side
+			uint64_t sent = 0;
+			uint64_t injectedLosses = 0;
+			// Messages replaced by a newer one before they went out
+			uint64_t superseded = 0;
+			// Receiver side
+			uint64_t received = 0;
+			uint64_t completed = 0;
+			uint64_t dropped = 0;
+			uint64_t recovered = 0;
+		};
+
+		// Sends messages as datagrams to one remote. The datagrams are written from the
+		// asio context, one message at a time: a message handed over while another is
+		// still going out waits for it, and is replaced by any newer one, so a slow link
+		// drops stale frames here instead of queueing them in the socket
+		template<typename T>
+		class datagram_sender : public std::enable_shared_from_this<datagram_sender<T>>
+		{
+		public:
+			datagram_sender(asio::io_context& asioContext, const asio::ip::udp::endpoint& endpoint, uint64_t nToken, size_t nGroupSize)
+				: m_Socket(asio::make_strand(asioContext)), m_nToken(nToken), m_nGroupSize(std::min<size_t>(nGroupSize, UINT16_MAX))
+			{
+				m_Socket.connect(endpoint);
+
+				// A large message leaves as a burst of datagrams
+				m_Socket.set_option(asio::socket_base::send_buffer_size(SocketBufferSize));
+			}
+
+			datagram_sender(const datagram_sender<T>&) = delete;
+
+		public:
+			// Drop this share of datagrams (0 to 1) instead of sending them, to see how
+			// the receiving side copes with a lossy link
+			void SetLossRate(double lossRate)
+			{
+				std::scoped_lock lock(m_Mutex);
+				m_LossRate = lossRate;
+			}
+
+			// Hand a message over to be sent as datagrams, returns false if it is too large
+			// for them. Never blocks, the body is shared rather than copied
+			bool Send(const shared_message<T>& msg)
+			{
+				size_t nDataCount = std::max<size_t>((msg.size() + DatagramFragmentSize - 1) / DatagramFragmentSize, 1);
+				if (nDataCount > UINT16_MAX || msg.size() > UINT32_MAX)
+					return false;
+
+				std::scoped_lock lock(m_Mutex);
+				if (m_bClosed)
+					return false;
+
+				if (m_bSending)
+				{
+					if (m_Pending)
+						m_nSuperseded++;
+					m_Pending = msg;
+					return true;
+				}
+
+				m_bSending = true;
+				m_Current = msg;
+				asio::post(m_Socket.get_executor(), [self = this->shared_from_this()]() { self->StartMessage(); });
+				return true;
+			}
+
+			// Stop sending, from any thread. Whatever is left is dropped and the socket
+			// closed from within its strand, so no write is left waiting on the context
+			void Close()
+			{
+				std::scoped_lock lock(m_Mutex);
+				m_bClosed = true;
+				asio::post(m_Socket.get_executor(),
+					[self = this->shared_from_this()]()
+					{
+						asio::error_code ec;
+						self->m_Socket.close(ec);
+					});
+			}
+
+			datagram_stats GetStats() const
+			{
+				datagram_stats stats;
+				stats.sent = m_nSent.load();
+				stats.injectedLosses = m_nInjectedLosses.load();
+				stats.superseded = m_nSuperseded.load();
+				return stats;
+			}
+
+		private:
+			// Lay out the headers and parity of the current message, then write its first
+			// datagram. Only ever runs on the socket's strand, as does everything below
+			void StartMessage()
+			{
+				size_t nSize = m_Current.size();
+				size_t nDataCount = std::max<size_t>((nSize + DatagramFragmentSize - 1) / DatagramFragmentSize, 1);
+				size_t nGroupCount = m_nGroupSize ? (nDataCount + m_nGroupSize - 1) / m_nGroupSize : 0;
+				const uint8_t* pBody = m_Current.body ? m_Current.body->data() : nullptr;
+
+				datagram_header<T> header;
+				header.token = m_nToken;
+				header.frame = m_nNextFrame++;
+				header.size = static_cast<uint32_t>(nSize);
+				header.id = m_Current.header.id;
+				header.dataCount = static_cast<uint16_t>(nDataCount);
+				header.groupSize = static_cast<uint16_t>(m_nGroupSize);
+
+				// Each group's parity is the XOR of its data fragments, short fragments
+				// count as padded with zeroes
+				m_Parity.assign(nGroupCount * DatagramFragmentSize, uint8_t(0));
+				for (size_t i = 0; i < nDataCount && m_nGroupSize; i++)
+				{
+					size_t nOffset = i * DatagramFragmentSize;
+					size_t nLength = std::min(DatagramFragmentSize, nSize - nOffset);
+					uint8_t* pParity = m_Parity.data() + (i / m_nGroupSize) * DatagramFragmentSize;
+					for (size_t n = 0; n < nLength; n++)
+						pParity[n] ^= pBody[nOffset + n];
+				}
+
+				// Every group's data fragments, then its parity fragment
+				m_Datagrams.clear();
+				for (size_t i = 0; i < nDataCount; i++)
+				{
+					size_t nOffset = i * DatagramFragmentSize;
+					header.index = static_cast<uint16_t>(i);
+					m_Datagrams.push_back({ header, pBody + nOffset, std::min(DatagramFragmentSize, nSize - nOffset) });
+
+					if (m_nGroupSize && ((i + 1) % m_nGroupSize == 0 || i + 1 == nDataCount))
+					{
+						header.index = static_cast<uint16_t>(nDataCount + i / m_nGroupSize);
+						m_Datagrams.push_back({ header, m_Parity.data() + (i / m_nGroupSize) * DatagramFragmentSize, DatagramFragmentSize });
+					}
+				}
+
+				m_nNextDatagram = 0;
+				WriteDatagram();
+			}
+
+			void WriteDatagram()
+			{
+				double lossRate;
+				{
+					std::scoped_lock lock(m_Mutex);
+					lossRate = m_LossRate;
+				}
+
+				while (m_nNextDatagram < m_Datagrams.size() && lossRate > 0.0 && m_LossDistribution(m_Random) < lossRate)
+				{
+					m_nInjectedLosses++;
+					m_nNextDatagram++;
+				}
+
+				if (m_nNextDatagram == m_Datagrams.size())
+				{
+					FinishMessage();
+					return;
+				}
+
+				const datagram& d = m_Datagrams[m_nNextDatagram++];
+				std::array<asio::const_buffer, 2> buffers = { asio::buffer(&d.header, sizeof(d.header)), asio::buffer(d.pData, d.nLength) };
+				m_Socket.async_send(buffers,
+					make_custom_alloc_handler(m_HandlerMemory, [self = this->shared_from_this()](const asio::error_code& ec, std::size_t)
+					{
+						// A datagram that cannot be sent is as good as lost on the way, so
+						// errors other than the socket closing are not worth reporting
+						if (ec == asio::error::operation_aborted || !self->m_Socket.is_open())
+							return;
+
+						self->m_nSent++;
+						self->WriteDatagram();
+					}));
+			}
+
+			// The current message is out, go on with the newest one handed over meanwhile
+			void FinishMessage()
+			{
+				std::scoped_lock lock(m_Mutex);
+				m_Current = {};
+				if (m_Pending && !m_bClosed)
+				{
+					m_Current = std::move(*m_Pending);
+					m_Pending.reset();
+					asio::post(m_Socket.get_executor(), [self = this->shared_from_this()]() { self->StartMessage(); });
+					return;
+				}
+
+				m_Pending.reset();
+				m_bSending = false;
+			}
+
+		private:
+			static constexpr int SocketBufferSize = 4 * 1024 * 1024;
+
+			// One datagram of the current message, pointing into its body or parity
+			struct datagram
+			{
+				datagram_header<T> header;
+				const uint8_t* pData = nullptr;
+				size_t nLength = 0;
+			};
+
+			asio::ip::udp::socket m_Socket;
+			uint64_t m_nToken = 0;
+			size_t m_nGroupSize = 0;
+
+			// Guards the hand-over between senders and the strand
+			std::mutex m_Mutex;
+			bool m_bSending = false;
+			bool m_bClosed = false;
+			shared_message<T> m_Current;
+			std::optional<shared_message<T>> m_Pending;
+			double m_LossRate = 0.0;
+
+			// The message going out, only touched on the strand
+			uint32_t m_nNextFrame = 0;
+			std::vector<uint8_t> m_Parity;
+			std::vector<datagram> m_Datagrams;
+			size_t m_nNextDatagram = 0;
+			handler_memory m_HandlerMemory;
+			std::mt19937 m_Random{ std::random_device{}() };
+			std::uniform_real_distribution<double> m_LossDistribution{ 0.0, 1.0 };
+
+			std::atomic<uint64_t> m_nSent = 0;
+			std::atomic<uint64_t> m_nInjectedLosses = 0;
+			std::atomic<uint64_t> m_nSuperseded = 0;
+		};
+
+		// Puts messages back together from the datagrams of any number of senders, each
+		// known by its session token. Must be fed from one thread at a time
+		template<typename T>
+		class datagram_receiver
+		{
+		public:
+			// Called with every message completed, and the token of its sender
+			using deliver_handler = std::function<void(uint64_t, message<T>&&)>;
+
+			datagram_receiver(buffer_pool& pool, deliver_handler handler)
+				: m_BufferPool(pool), m_DeliverHandler(std::move(handler))
+			{
+			}
+
+			datagram_receiver(const datagram_receiver<T>&) = delete;
+
+		public:
+			// Take in one datagram, invalid ones are ignored
+			void Receive(const uint8_t* pData, size_t nSize)
+			{
+				if (nSize < sizeof(datagram_header<T>))
+					return;
+
+				datagram_header<T> header;
+				std::memcpy(&header, pData, sizeof(header));
+				pData += sizeof(header);
+				nSize -= sizeof(header);
+
+				if (!IsValid(header, nSize))
+					return;
+
+				m_nReceived++;
+
+				sender& s = m_Senders[header.token];
+
+				// Anything older than the last message delivered is too late to matter
+				if (s.bDelivered && static_cast<int32_t>(header.frame - s.nLastDelivered) <= 0)
+					return;
+
+				partial_frame* pFrame = FindFrame(s, header);
+				if (!pFrame)
+					return;
+
+				size_t nIndex = header.index;
+				if (pFrame->received[nIndex])
+					return;
+				pFrame->received[nIndex] = true;
+
+				size_t nGroup;
+				if (nIndex < header.dataCount)
+				{
+					// Data fragments go straight to their place in the body, the body is
+					// padded to whole fragments so the parity maths never runs off its end
+					std::memcpy(pFrame->msg.body.data() + nIndex * DatagramFragmentSize, pData, nSize);
+					pFrame->nDataReceived++;
+					nGroup = header.groupSize ? nIndex / header.groupSize : 0;
+				}
+				else
+				{
+					nGroup = nIndex - header.dataCount;
+					std::memcpy(pFrame->parity.data() + nGroup * DatagramFragmentSize, pData, DatagramFragmentSize);
+				}
+
+				if (header.groupSize)
+					Recover(*pFrame, nGroup);
+
+				if (pFrame->nDataReceived == header.dataCount)
+					Deliver(s, *pFrame);
+			}
+
+			// Forget the state kept for a sender that has gone
+			void Forget(uint64_t nToken)
+			{
+				auto it = m_Senders.find(nToken);
+				if (it == m_Senders.end())
+					return;
+
+				for (partial_frame& frame : it->second.frames)
+					m_BufferPool.Release(std::move(frame.msg.body));
+				m_Senders.erase(it);
+			}
+
+			datagram_stats GetStats() const
+			{
+				datagram_stats stats;
+				stats.received = m_nReceived.load();
+				stats.completed = m_nCompleted.load();
+				stats.dropped = m_nDropped.load();
+				stats.recovered = m_nRecovered.load();
+				return stats;
+			}
+
+		private:
+			struct partial_frame
+			{
+				datagram_header<T> header;
+				message<T> msg;
+				std::vector<uint8_t> parity;
+				std::vector<bool> received;
+				size_t nDataReceived = 0;
+			};
+
+			struct sender
+			{
+				// Oldest first
+				std::deque<partial_frame> frames;
+				uint32_t nLastDelivered = 0;
+				bool bDelivered = false;
+			};
+
+			static size_t ParityCount(const datagram_header<T>& header)
+			{
+				return header.groupSize ? (header.dataCount + header.groupSize - 1) / header.groupSize : 0;
+			}
+
+			bool IsValid(const datagram_header<T>& header, size_t nPayload) const
+			{
+				if (header.dataCount == 0 || header.size > MaxMessageSize)
+					return false;
+
+				// The size must need exactly dataCount fragments
+				if (std::max<size_t>((header.size + DatagramFragmentSize - 1) / DatagramFragmentSize, 1) != header.dataCount)
+					return false;
+
+				if (header.index < header.dataCount)
+				{
+					size_t nOffset = size_t(header.index) * DatagramFragmentSize;
+					return nPayload == std::min(DatagramFragmentSize, header.size - nOffset);
+				}
+				return header.index < header.dataCount + ParityCount(header) && nPayload == DatagramFragmentSize;
+			}
+
+			partial_frame* FindFrame(sender& s, const datagram_header<T>& header)
+			{
+				for (partial_frame& frame : s.frames)
+				{
+					if (frame.header.frame == header.frame)
+					{
+						// Fragments of one message must all agree on its shape
+						if (frame.header.size != header.size || frame.header.dataCount != header.dataCount || frame.header.groupSize != header.groupSize || frame.header.id != header.id)
+							return nullptr;
+						return &frame;
+					}
+				}
+
+				// A new message, making room by giving up on the oldest one if needed
+				if (s.frames.size() == MaxFramesInFlight)
+				{
+					m_BufferPool.Release(std::move(s.frames.front().msg.body));
+					s.frames.pop_front();
+					m_nDropped++;
+				}
+
+				partial_frame& frame = s.frames.emplace_back();
+				frame.header = header;
+				frame.msg.header.id = header.id;
+				frame.msg.body = m_BufferPool.Acquire(size_t(header.dataCount) * DatagramFragmentSize);
+				std::fill(frame.msg.body.begin() + header.size, frame.msg.body.end(), uint8_t(0));
+				frame.parity.resize(ParityCount(header) * DatagramFragmentSize);
+				frame.received.assign(header.dataCount + ParityCount(header), false);
+				return &frame;
+			}
+
+			// With the parity of a group and all but one of its data fragments, the
+			// missing one is the XOR of the others
+			void Recover(partial_frame& frame, size_t nGroup)
+			{
+				const datagram_header<T>& header = frame.header;
+				if (!frame.received[header.dataCount + nGroup])
+					return;
+
+				size_t nFirst = nGroup * header.groupSize;
+				size_t nLast = std::min<size_t>(nFirst + header.groupSize, header.dataCount);
+
+				size_t nMissing = nLast;
+				for (size_t i = nFirst; i < nLast; i++)
+				{
+					if (frame.received[i])
+						continue;
+					if (nMissing != nLast)
+						return;
+					nMissing = i;
+				}
+				if (nMissing == nLast)
+					return;
+
+				uint8_t* pMissing = frame.msg.body.data() + nMissing * DatagramFragmentSize;
+				std::memcpy(pMissing, frame.parity.data() + nGroup * DatagramFragmentSize, DatagramFragmentSize);
+				for (size_t i = nFirst; i < nLast; i++)
+				{
+					if (i == nMissing)
+						continue;
+
+					const uint8_t* pFragment = frame.msg.body.data() + i * DatagramFragmentSize;
+					for (size_t n = 0; n < DatagramFragmentSize; n++)
+						pMissing[n] ^= pFragment[n];
+				}
+
+				frame.received[nMissing] = true;
+				frame.nDataReceived++;
+				m_nRecovered++;
+			}
+
+			// Hand the message over, anything older still incomplete is now worthless.
+			// "frame" is gone once this returns
+			void Deliver(sender& s, partial_frame& frame)
+			{
+				uint32_t nFrame = frame.header.frame;
+				uint64_t nToken = frame.header.token;
+
+				message<T> msg = std::move(frame.msg);
+				msg.body.resize(frame.header.size);
+				msg.header.size = frame.header.size;
+
+				while (!s.frames.empty())
+				{
+					bool bDelivered = s.frames.front().header.frame == nFrame;
+					if (!bDelivered)
+					{
+						m_BufferPool.Release(std::move(s.frames.front().msg.body));
+						m_nDropped++;
+					}
+					s.frames.pop_front();
+					if (bDelivered)
+						break;
+				}
+
+				s.nLastDelivered = nFrame;
+				s.bDelivered = true;
+				m_nCompleted++;
+
+				m_DeliverHandler(nToken, std::move(msg));
+			}
+
+		private:
+			// Messages being put together at once per sender, and the largest accepted
+			static constexpr size_t MaxFramesInFlight = 4;
+			static constexpr size_t MaxMessageSize = 64 * 1024 * 1024;
+
+			buffer_pool& m_BufferPool;
+			deliver_handler m_DeliverHandler;
+			std::unordered_map<uint64_t, sender> m_Senders;
+
+			std::atomic<uint64_t> m_nReceived = 0;
+			std::atomic<uint64_t> m_nCompleted = 0;
+			std::atomic<uint64_t> m_nDropped = 0;
+			std::atomic<uint64_t> m_nRecovered = 0;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace rpc
+{
+	namespace net
+	{
+		// Memory for one completion handler at a time. asio asks the handler's associated
+		// allocator for the memory of every operation it starts, and frees it just before
+		// calling the handler. A connection only ever has one read and one write in flight,
+		// so each of them can keep reusing blocks of its own instead of going to the heap
+		// for every operation. There are two blocks, as a handler posted through a strand
+		// that is not running yet also needs the strand's invoker. A handler too large for
+		// a block, or one that turns up while both are taken, falls back to the heap.
+		class handler_memory
+		{
+		public:
+			handler_memory() = default;
+			handler_memory(const handler_memory&) = delete;
+
+		public:
+			void* Allocate(size_t size)
+			{
+				if (size <= BlockSize)
+				{
+					for (size_t i = 0; i < BlockCount; i++)
+					{
+						if (!m_bInUse[i].exchange(true, std::memory_order_acquire))
+							return &m_Storage[i];
+					}
+				}
+
+				m_nHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+				return ::operator new(size);
+			}
+
+			void Deallocate(void* pointer)
+			{
+				for (size_t i = 0; i < BlockCount; i++)
+				{
+					if (pointer == &m_Storage[i])
+					{
+						m_bInUse[i].store(false, std::memory_order_release);
+						return;
+					}
+				}
+				::operator delete(pointer);
+			}
+
+			// Number of handlers that did not fit, should stay put once running
+			size_t GetHeapAllocations() const
+			{
+				return m_nHeapAllocations.load(std::memory_order_relaxed);
+			}
+
+		private:
+			static constexpr size_t BlockSize = 1024;
+			static constexpr size_t BlockCount = 2;
+
+			alignas(std::max_align_t) std::byte m_Storage[BlockCount][BlockSize];
+			std::atomic<bool> m_bInUse[BlockCount] = {};
+			std::atomic<size_t> m_nHeapAllocations = 0;
+		};
+
+		// Standard allocator handing out the memory of a handler_memory
+		template<typename U>
+		class handler_allocator
+		{
+		public:
+			using value_type = U;
+
+			explicit handler_allocator(handler_memory& memory)
+				: m_pMemory(&memory)
+			{
+			}
+
+			template<typename V>
+			handler_allocator(const handler_allocator<V>& other) noexcept
+				: m_pMemory(other.m_pMemory)
+			{
+			}
+
+			bool operator==(const handler_allocator& other) const noexcept
+			{
+				return m_pMemory == other.m_pMemory;
+			}
+
+			U* allocate(size_t n) const
+			{
+				return static_cast<U*>(m_pMemory->Allocate(sizeof(U) * n));
+			}
+
+			void deallocate(U* pointer, size_t) const
+			{
+				m_pMemory->Deallocate(pointer);
+			}
+
+		private:
+			template<typename> friend class handler_allocator;
+			handler_memory* m_pMemory;
+		};
+
+		// Wraps a completion handler, so asio allocates its operation from a handler_memory
+		template<typename Handler>
+		class custom_alloc_handler
+		{
+		public:
+			using allocator_type = handler_allocator<Handler>;
+
+			custom_alloc_handler(handler_memory& memory, Handler handler)
+				: m_Memory(memory), m_Handler(std::move(handler))
+			{
+			}
+
+			allocator_type get_allocator() const noexcept
+			{
+				return allocator_type(m_Memory);
+			}
+
+			template<typename... Args>
+			void operator()(Args&&... args)
+			{
+				m_Handler(std::forward<Args>(args)...);
+			}
+
+		private:
+			handler_memory& m_Memory;
+			Handler m_Handler;
+		};
+
+		template<typename Handler>
+		inline custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory& memory, Handler handler)
+		{
+			return custom_alloc_handler<Handler>(memory, std::move(handler));
+		}
+
+		// Allocator for containers that keep freeing and allocating blocks of the same few
+		// sizes, like a deque used as a queue, which drops a block each time its front moves
+		// past one and takes a new one each time its back runs out. A handful of freed
+		// blocks are kept by each thread, and handed out again for the next allocation of
+		// the same size.
+		template<typename U>
+		class recycling_allocator
+		{
+		public:
+			using value_type = U;
+
+			recycling_allocator() noexcept = default;
+
+			template<typename V>
+			recycling_allocator(const recycling_allocator<V>&) noexcept
+			{
+			}
+
+			bool operator==(const recycling_allocator&) const noexcept
+			{
+				return true;
+			}
+
+			U* allocate(size_t n) const
+			{
+				size_t nBytes = sizeof(U) * n;
+				for (block& cached : Cache().blocks)
+				{
+					if (cached.pointer && cached.size == nBytes)
+						return static_cast<U*>(std::exchange(cached.pointer, nullptr));
+				}
+				return static_cast<U*>(::operator new(nBytes));
+			}
+
+			void deallocate(U* pointer, size_t n) const
+			{
+				for (block& cached : Cache().blocks)
+				{
+					if (!cached.pointer)
+					{
+						cached.pointer = pointer;
+						cached.size = sizeof(U) * n;
+						return;
+					}
+				}
+				::operator delete(pointer);
+			}
+
+		private:
+			struct block
+			{
+				void* pointer = nullptr;
+				size_t size = 0;
+			};
+
+			struct block_cache
+			{
+				std::array<block, 64> blocks;
+
+				~block_cache()
+				{
+					for (block& cached : blocks)
+						::operator delete(cached.pointer);
+				}
+			};
+
+			static block_cache& Cache()
+			{
+				static thread_local block_cache cache;
+				return cache;
+			}
+		};
+	}
+}
\ No newline at end of file
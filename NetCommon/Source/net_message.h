@@ -6,11 +6,73 @@ namespace rpc
 {
   namespace net
   {
+    // Flags carried in every message header, used by the network layer itself
+    struct message_flags
+    {
+      // The body is one chunk of a larger message, and starts with a chunk_header
+      static constexpr uint32_t chunk = 1 << 0;
+
+      // The message is a step of the session handshake, it is handled by the network
+      // layer and never reaches the application
+      static constexpr uint32_t session = 1 << 1;
+    };
+
+    // A client in session mode opens a second connection for bulk messages, so frames
+    // never hold up control messages behind them. Session messages carry a step and a
+    // token, the steps go:
+    //  open  - client to server on the first connection, asking for a session
+    //  token - server to client, the token proving the second connection is ours
+    //  join  - client to server on the second connection, presenting the token
+    // A client on the same host as the server may then also offer a shared memory ring,
+    // see shared_memory_ring:
+    //  shared_memory - client to server naming the ring by the token, and server to
+    //                  client once it reads from it
+    enum class session_step : uint32_t
+    {
+      open,
+      token,
+      join,
+      shared_memory
+    };
+
+    // How urgently a message must go out. Queued control and interactive messages are
+    // always written before the next bulk message, so they never wait behind frames
+    enum class message_priority
+    {
+      control,
+      interactive,
+      bulk
+    };
+
     template<typename T>
     struct message_header
     {
       T id = {};
       uint32_t size = 0;
+      uint32_t flags = 0;
+    };
+
+    // Large messages are sent as a stream of chunks, each one a message of its own whose
+    // body starts with this header, telling where its bytes go in the full message
+    struct chunk_header
+    {
+      uint32_t stream = 0;
+      uint32_t length = 0;
+      uint64_t offset = 0;
+      uint64_t total = 0;
+    };
+
+    // Progress of a large message arriving in chunks. Chunks arrive in order, so the
+    // first "received" bytes of "data" are always complete
+    struct stream_progress
+    {
+      uint32_t stream = 0;
+      // Where the chunk that just arrived starts in the full message, and its length
+      uint64_t offset = 0;
+      uint64_t length = 0;
+      uint64_t received = 0;
+      uint64_t total = 0;
+      const uint8_t* data = nullptr;
     };
 
     template<typename T>
@@ -25,6 +87,17 @@ namespace rpc
         header.size = body.size();
       }
 
+      // Adopts the buffer as the message body when the body is still empty, so large
+      // payloads (encoded frames) become the body without being copied
+      void push_back(std::vector<uint8_t>&& buffer)
+      {
+        if (body.empty())
+          body = std::move(buffer);
+        else
+          body.insert(body.end(), buffer.begin(), buffer.end());
+        header.size = body.size();
+      }
+
       void pull_back(std::vector<uint8_t>& out_buffer, size_t size)
       {
         if (size > body.size())
@@ -59,6 +132,30 @@ namespace rpc
       }
     };
 
+    // An immutable message whose body is reference counted. Once built, the same
+    // encoded payload can be queued on any number of connections, each of them only
+    // holding a reference to it, so broadcasting never duplicates the body
+    template<typename T>
+    struct shared_message
+    {
+      message_header<T> header = {};
+      std::shared_ptr<const std::vector<uint8_t>> body;
+
+      shared_message() = default;
+
+      explicit shared_message(message<T>&& msg)
+        : header(msg.header)
+      {
+        if (!msg.body.empty())
+          body = std::make_shared<const std::vector<uint8_t>>(std::move(msg.body));
+      }
+
+      size_t size() const
+      {
+        return body ? body->size() : 0;
+      }
+    };
+
     template<typename T>
     class connection;
 
@@ -67,6 +164,9 @@ namespace rpc
     {
       std::shared_ptr<connection<T>> remote = nullptr;
       message<T> msg;
+      // When the message was put in the incoming queue, it may wait a while there
+      // before being handled, which matters to anything timing the network
+      std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
     };
   }
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace rpc
+{
+	// A lock-free queue for many producer threads and a single consumer thread.
+	// Items are moved in and out of a fixed ring of slots, each slot carrying a sequence
+	// number that tells producers and the consumer whose turn it is, so neither side ever
+	// takes a lock. The consumer can block in wait() until something arrives, the wakeup
+	// goes through std::atomic::wait (a futex on Linux) and producers only pay for it
+	// while the consumer is actually asleep.
+	//
+	// The queue is bounded by its ring. Pushing never blocks, and never grows the queue
+	// either: try_push tells the caller the ring is full, and the caller decides whether
+	// the item is dropped, held back or retried later.
+	template<typename T>
+	class mpsc_queue
+	{
+	public:
+		explicit mpsc_queue(size_t capacity = 4096)
+		{
+			// The ring size must be a power of two, so positions map onto slots with a mask
+			size_t nSlots = std::bit_ceil(std::max<size_t>(capacity, 2));
+			m_Slots = std::make_unique<slot[]>(nSlots);
+			m_Mask = nSlots - 1;
+
+			for (size_t i = 0; i < nSlots; i++)
+				m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		mpsc_queue(const mpsc_queue<T>&) = delete;
+
+	public:
+		// PRODUCERS - Try to move an item in, fails (leaving the item alone) if the ring is
+		// full
+		bool try_push(T&& item)
+		{
+			size_t nPos = m_EnqueuePos.load(std::memory_order_relaxed);
+			slot* pSlot = nullptr;
+
+			while (true)
+			{
+				pSlot = &m_Slots[nPos & m_Mask];
+				size_t nSequence = pSlot->sequence.load(std::memory_order_acquire);
+				intptr_t nDiff = static_cast<intptr_t>(nSequence) - static_cast<intptr_t>(nPos);
+
+				if (nDiff == 0)
+				{
+					// The slot is free, claim it by moving the enqueue position past it
+					if (m_EnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (nDiff < 0)
+				{
+					// The slot still holds an item the consumer has not taken, we are full
+					return false;
+				}
+				else
+				{
+					// Another producer claimed this slot first, try the next one
+					nPos = m_EnqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			// Publish the item to the consumer
+			pSlot->data = std::move(item);
+			pSlot->sequence.store(nPos + 1, std::memory_order_release);
+
+			Notify();
+			return true;
+		}
+
+		bool try_push(const T& item)
+		{
+			return try_push(T(item));
+		}
+
+		// CONSUMER - Try to move the oldest item out, fails if the queue is empty
+		bool try_pop(T& item)
+		{
+			size_t nPos = m_DequeuePos.load(std::memory_order_relaxed);
+			slot& s = m_Slots[nPos & m_Mask];
+
+			if (s.sequence.load(std::memory_order_acquire) != nPos + 1)
+				return false;
+
+			item = std::move(s.data);
+
+			// Hand the slot back to the producers, one lap ahead
+			s.sequence.store(nPos + m_Mask + 1, std::memory_order_release);
+			m_DequeuePos.store(nPos + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// CONSUMER - Move the oldest item out, the queue must not be empty
+		T pop_front()
+		{
+			T item;
+			while (!try_pop(item))
+				std::this_thread::yield();
+			return item;
+		}
+
+		// CONSUMER - Move every item queued right now (up to "nMaxItems") to the back of
+		// "items", returns how many were moved. Items pushed while draining are left for
+		// the next call, so a busy producer cannot keep the consumer here forever
+		size_t drain(std::vector<T>& items, size_t nMaxItems = -1)
+		{
+			size_t nItems = std::min(nMaxItems, count());
+			size_t nDrained = 0;
+
+			T item;
+			while (nDrained < nItems && try_pop(item))
+			{
+				items.push_back(std::move(item));
+				nDrained++;
+			}
+			return nDrained;
+		}
+
+		// CONSUMER - Is there an item ready to be taken?
+		bool empty() const
+		{
+			size_t nPos = m_DequeuePos.load(std::memory_order_relaxed);
+			return m_Slots[nPos & m_Mask].sequence.load(std::memory_order_acquire) != nPos + 1;
+		}
+
+		// Approximate number of queued items, exact when no producer is mid push
+		size_t count() const
+		{
+			size_t nEnqueuePos = m_EnqueuePos.load(std::memory_order_relaxed);
+			size_t nDequeuePos = m_DequeuePos.load(std::memory_order_relaxed);
+			return nEnqueuePos > nDequeuePos ? nEnqueuePos - nDequeuePos : 0;
+		}
+
+		// Most items the queue holds at once
+		size_t capacity() const
+		{
+			return m_Mask + 1;
+		}
+
+		// CONSUMER - Throw away everything queued
+		void clear()
+		{
+			T item;
+			while (try_pop(item));
+		}
+
+		// CONSUMER - Sleep until there is at least one item to take
+		void wait()
+		{
+			while (empty())
+			{
+				uint32_t nSignal = m_Signal.load(std::memory_order_acquire);
+
+				// Announce we are going to sleep, then look once more, so a producer that
+				// pushed in between is either seen here or sees us waiting and wakes us
+				m_bConsumerWaiting.store(true, std::memory_order_seq_cst);
+				if (!empty())
+				{
+					m_bConsumerWaiting.store(false, std::memory_order_relaxed);
+					break;
+				}
+
+				m_Signal.wait(nSignal, std::memory_order_acquire);
+				m_bConsumerWaiting.store(false, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		void Notify()
+		{
+			m_Signal.fetch_add(1, std::memory_order_seq_cst);
+			if (m_bConsumerWaiting.load(std::memory_order_seq_cst))
+				m_Signal.notify_one();
+		}
+
+	private:
+		struct slot
+		{
+			std::atomic<size_t> sequence = 0;
+			T data = {};
+		};
+
+		std::unique_ptr<slot[]> m_Slots;
+		size_t m_Mask = 0;
+
+		// Producers and the consumer each hammer their own position, keep them
+		// on separate cache lines
+		alignas(64) std::atomic<size_t> m_EnqueuePos = 0;
+		alignas(64) std::atomic<size_t> m_DequeuePos = 0;
+
+		alignas(64) std::atomic<uint32_t> m_Signal = 0;
+		std::atomic<bool> m_bConsumerWaiting = false;
+	};
+}
\ No newline at end of file
@@ -3,9 +3,13 @@
 #include <YKLib.h>
 
 #include "net_common.h"
-#include "net_tsdeque.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_buffer_pool.h"
+#include "net_connection_registry.h"
+#include "net_datagram.h"
+#include "net_shared_memory.h"
 
 namespace rpc
 {
@@ -17,7 +21,7 @@ namespace rpc
 		public:
 			// Create a server, ready to listen on specified port
 			ServerInterface(uint16_t port)
-				: m_AsioAcceptor(m_AsioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+				: m_AsioAcceptor(m_AsioContext), m_nPort(port)
 			{
 
 			}
@@ -33,15 +37,48 @@ namespace rpc
 			{
 				try
 				{
+					asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_nPort);
+
+					// Several acceptors can only share the port where the system lets
+					// sockets reuse it, elsewhere a single acceptor does all the work
+					size_t nAcceptors = m_nAcceptorCount;
+#if !defined(SO_REUSEPORT)
+					nAcceptors = 1;
+#endif
+					OpenAcceptor(m_AsioAcceptor, endpoint, nAcceptors > 1);
+
 					// Issue a task to the asio context - This is important
 					// as it will prime the context with "work", and stop it
 					// from exiting immediately. Since this is a server, we 
 					// want it primed ready to handle clients trying to
 					// connect.
-					WaitForClientConnection();
+					WaitForClientConnection(m_AsioAcceptor);
+
+					// Datagrams arrive on the same port number, over UDP
+					if (m_bDatagrams)
+					{
+						m_DatagramSocket.open(asio::ip::udp::v4());
+						m_DatagramSocket.set_option(asio::socket_base::receive_buffer_size(DatagramSocketBufferSize));
+						m_DatagramSocket.bind(asio::ip::udp::endpoint(asio::ip::udp::v4(), m_nPort));
+						ReceiveDatagram();
+					}
 
-					// Launch the asio context in its own thread
-					m_ThreadContext = std::thread([this]() { m_AsioContext.run(); });
+					// Every other acceptor waits on a context and thread of its own, the
+					// system hands each incoming connection to one of them
+					for (size_t i = 1; i < nAcceptors; i++)
+					{
+						std::unique_ptr<acceptor_context>& ctx = m_AcceptorContexts.emplace_back(std::make_unique<acceptor_context>());
+						OpenAcceptor(ctx->acceptor, endpoint, true);
+						WaitForClientConnection(ctx->acceptor);
+						ctx->thread = std::thread([&context = ctx->context]() { context.run(); });
+					}
+
+					// Launch the asio context on its pool of threads, every connection
+					// lives on a strand so any thread can serve it
+					for (size_t i = 0; i < m_nThreadCount; i++)
+						m_ThreadContexts.emplace_back([this]() { m_AsioContext.run(); });
+
+					std::cout << "[SERVER] Listening on port " << m_nPort << ", socket I/O on " << GetIOBackendName() << "\n";
 				}
 				catch (std::exception& e)
 				{
@@ -57,20 +94,50 @@ namespace rpc
 			{
 				// Request the context to close
 				m_AsioContext.stop();
-
-				// Tidy up the context thread
-				if (m_ThreadContext.joinable()) m_ThreadContext.join();
+				for (std::unique_ptr<acceptor_context>& ctx : m_AcceptorContexts)
+					ctx->context.stop();
+
+				// Tidy up the context threads
+				for (std::thread& thread : m_ThreadContexts)
+					if (thread.joinable()) thread.join();
+				m_ThreadContexts.clear();
+
+				for (std::unique_ptr<acceptor_context>& ctx : m_AcceptorContexts)
+					if (ctx->thread.joinable()) ctx->thread.join();
+				m_AcceptorContexts.clear();
+
+				// Close whatever is still open, and run what the stopped context still
+				// holds, cancelled handlers included. Their memory lives in the connections,
+				// none may be left queued once the connections are destroyed
+				asio::error_code ec;
+				m_AsioAcceptor.close(ec);
+				m_DatagramSocket.close(ec);
+				for (const std::shared_ptr<connection<T>>& client : *m_Connections.Snapshot())
+					client->Disconnect();
+				m_AsioContext.restart();
+				m_AsioContext.poll();
+				m_Connections.Clear();
+
+				// And the threads reading shared memory rings
+				std::scoped_lock lock(m_SessionMutex);
+				m_SharedMemoryReceivers.clear();
 			}
 
 			// ASYNC - Instruct asio to wait for connection
-			void WaitForClientConnection()
+			void WaitForClientConnection(asio::ip::tcp::acceptor& acceptor)
 			{
 				// Prime context with an instruction to wait until a socket connects. This
 				// is the purpose of an "acceptor" object. It will provide a unique socket
-				// for each incoming connection attempt
-				m_AsioAcceptor.async_accept(
-					[this](std::error_code ec, asio::ip::tcp::socket socket)
+				// for each incoming connection attempt. The socket is created on a strand
+				// of its own, so its handlers are serialised whichever thread runs them. It
+				// always belongs to the main context, whichever acceptor accepted it
+				acceptor.async_accept(asio::make_strand(m_AsioContext),
+					[this, &acceptor](std::error_code ec, typename connection<T>::socket_type socket)
 					{
+						// The acceptor was closed, the server is stopping
+						if (!acceptor.is_open())
+							return;
+
 						// Triggered by incoming connection request
 						if (!ec)
 						{
@@ -80,21 +147,37 @@ namespace rpc
 							// Create a new connection to handle this client 
 							std::shared_ptr<connection<T>> newconn =
 								std::make_shared<connection<T>>(connection<T>::owner::server,
-									m_AsioContext, std::move(socket), m_MessagesIn);
+									m_AsioContext, std::move(socket), m_MessagesIn, m_BufferPool);
+
 
 
+							newconn->SetReadMode(m_ReadMode);
+							newconn->SetChunkSize(m_ChunkSize);
+							newconn->SetProgressHandler(
+								[this](std::shared_ptr<connection<T>> client, const message_header<T>& header, const stream_progress& progress)
+								{
+									OnMessageProgress(client, header, progress);
+								});
+							newconn->SetSessionHandler(
+								[this](connection<T>& client, message<T>& msg)
+								{
+									OnSessionMessage(client, msg);
+								});
 
 							// Give the user server a chance to deny connection
 							if (OnClientConnect(newconn))
 							{
-								// Connection allowed, so add to container of new connections
-								m_Connections.push_back(std::move(newconn));
+								// Connection allowed, so add to the registry of connections. It is
+								// registered before it reads anything, a session handshake arriving
+								// on it may already need to find it there
+								uint32_t nID = m_IDCounter++;
+								m_Connections.Add(nID, newconn);
 
 								// And very important! Issue a task to the connection's
 								// asio context to sit and wait for bytes to arrive!
-								m_Connections.back()->ConnectToClient(m_IDCounter++);
+								newconn->ConnectToClient(nID);
 
-								std::cout << "[" << m_Connections.back()->GetID() << "] Connection Approved\n";
+								std::cout << "[" << nID << "] Connection Approved\n";
 							}
 							else
 							{
@@ -112,85 +195,396 @@ namespace rpc
 
 						// Prime the asio context with more work - again simply wait for
 						// another connection...
-						WaitForClientConnection();
+						WaitForClientConnection(acceptor);
 					});
 			}
 
-			// Send a message to a specific client
-			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+			// Send a message to a specific client. Returns false if it could not be queued,
+			// because the client is gone or too many messages are waiting for it already
+			bool MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg, message_priority priority = message_priority::bulk)
+			{
+				return MessageClient(std::move(client), message<T>(msg), priority);
+			}
+
+			// Send a message to a specific client, moving it instead of copying its body
+			bool MessageClient(std::shared_ptr<connection<T>> client, message<T>&& msg, message_priority priority = message_priority::bulk)
+			{
+				return MessageClient(std::move(client), shared_message<T>(std::move(msg)), priority);
+			}
+
+			// Send a shared message to a specific client
+			bool MessageClient(std::shared_ptr<connection<T>> client, const shared_message<T>& msg, message_priority priority = message_priority::bulk)
 			{
 				// Check client is legitimate...
 				if (client && client->IsConnected())
 				{
 					// ...and post the message via the connection
-					client->Send(msg);
+					return client->Send(msg, priority);
 				}
-				else
+				else if (client)
 				{
 					// If we cant communicate with client then we may as 
 					// well remove the client - let the server know, it may
 					// be tracking it somehow
-					OnClientDisconnect(client);
-
-					// Off you go now, bye bye!
-					client.reset();
-
-					// Then physically remove it from the container
-					m_Connections.erase(std::remove(m_Connections.begin(), m_Connections.end(), client), m_Connections.end());
+					RemoveClient(client);
 				}
+				return false;
 			}
 
 			// Send message to all clients
-			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr, message_priority priority = message_priority::bulk)
 			{
-				bool bInvalidClientExists = false;
+				MessageAllClients(message<T>(msg), std::move(pIgnoreClient), priority);
+			}
 
-				// Iterate through all clients in container
-				for (auto& client : m_Connections)
+			// Send message to all clients, moving it instead of copying its body
+			void MessageAllClients(message<T>&& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr, message_priority priority = message_priority::bulk)
+			{
+				MessageAllClients(shared_message<T>(std::move(msg)), std::move(pIgnoreClient), priority);
+			}
+
+			// Send a shared message to all clients. Every connection queues a reference to
+			// the same body, so the memory used does not grow with the number of clients
+			void MessageAllClients(const shared_message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr, message_priority priority = message_priority::bulk)
+			{
+				// Iterate through a snapshot of the clients, it stays the same even if
+				// clients connect or are removed meanwhile
+				std::shared_ptr<const typename connection_registry<T>::connection_list> clients = m_Connections.Snapshot();
+				for (const std::shared_ptr<connection<T>>& client : *clients)
 				{
 					// Check client is connected...
-					if (client && client->IsConnected())
+					if (client->IsConnected())
 					{
 						// ..it is!
 						if (client != pIgnoreClient)
-							client->Send(msg);
+							client->Send(msg, priority);
 					}
 					else
 					{
 						// The client couldnt be contacted, so assume it has
 						// disconnected.
-						OnClientDisconnect(client);
-						client.reset();
-
-						// Set this flag to then remove dead clients from container
-						bInvalidClientExists = true;
+						RemoveClient(client);
 					}
 				}
+			}
 
-				// Remove dead clients, all in one go - this way, we dont invalidate the
-				// container as we iterated through it.
-				if (bInvalidClientExists)
-					m_Connections.erase(
-						std::remove(m_Connections.begin(), m_Connections.end(), nullptr), m_Connections.end());
+			// Look up a connected client by its ID, nullptr if there is none
+			std::shared_ptr<connection<T>> GetClient(uint32_t nID) const
+			{
+				return m_Connections.Find(nID);
 			}
 
-			// Force server to respond to incoming messages
-			void Update(size_t nMaxMessages = -1, bool bWait = false)
+			// Number of clients currently registered
+			size_t GetClientCount() const
+			{
+				return m_Connections.Count();
+			}
+
+			// Close a client's connection and forget it. OnClientDisconnect is called, unless
+			// the client was forgotten already. Use it for a client found closed, which is
+			// otherwise only noticed the next time a message is sent to it
+			void DisconnectClient(const std::shared_ptr<connection<T>>& client)
+			{
+				if (!client)
+					return;
+
+				client->Disconnect();
+				RemoveClient(client);
+			}
+
+			// Force server to respond to incoming messages. By default the whole batch
+			// of messages waiting at the time of the call is processed
+			size_t Update(size_t nMaxMessages = -1, bool bWait = false)
 			{
 				if (bWait) m_MessagesIn.wait();
 
-				// Process as many messages as you can up to the value
-				// specified
-				size_t nMessageCount = 0;
-				while (nMessageCount < nMaxMessages && !m_MessagesIn.empty())
-				{
-					// Grab the front message
-					auto msg = m_MessagesIn.pop_front();
+				// Take every message waiting right now, up to the value specified, out
+				// of the queue in one go...
+				m_MessagesBatch.clear();
+				size_t nMessageCount = m_MessagesIn.drain(m_MessagesBatch, nMaxMessages);
 
+				// ...and process them
+				for (owned_message<T>& msg : m_MessagesBatch)
+				{
 					// Pass to message handler
+					m_MessageReceived = msg.received;
 					OnMessage(msg.remote, msg.msg);
 
-					nMessageCount++;
+					// Whatever is left of the body goes back to the pool, ready to
+					// receive another message
+					m_BufferPool.Release(std::move(msg.msg.body));
+				}
+
+				// Let go of the connections the batch referenced, the vector keeps its
+				// storage for the next batch
+				m_MessagesBatch.clear();
+				return nMessageCount;
+			}
+
+			// Choose how connections accepted from now on read incoming bytes
+			void SetReadMode(typename connection<T>::read_mode mode)
+			{
+				m_ReadMode = mode;
+			}
+
+			// Choose the size of the chunks large messages are sent to connections accepted
+			// from now on in, zero sends every message whole
+			void SetChunkSize(size_t nChunkSize)
+			{
+				m_ChunkSize = nChunkSize;
+			}
+
+			// Choose how many acceptors listen on the port, must be called before Start.
+			// They share the port through SO_REUSEPORT and each waits on its own thread,
+			// so a storm of clients reconnecting at once is accepted in parallel rather
+			// than queueing behind traffic. Without SO_REUSEPORT a single one is used
+			void SetAcceptorCount(size_t nAcceptors)
+			{
+				m_nAcceptorCount = std::max<size_t>(nAcceptors, 1);
+			}
+
+			// Choose how many threads run the asio context, must be called before Start.
+			// With many clients connected a single thread becomes the bottleneck
+			void SetThreadCount(size_t nThreads)
+			{
+				m_nThreadCount = std::max<size_t>(nThreads, 1);
+			}
+
+			// Accept messages sent as datagrams by clients in session mode, see
+			// datagram_header. Must be called before Start
+			void SetDatagramTransport(bool bDatagrams)
+			{
+				m_bDatagrams = bDatagrams;
+			}
+
+			// Counters of the messages received as datagrams
+			datagram_stats GetDatagramStats() const
+			{
+				return m_DatagramReceiver.GetStats();
+			}
+
+			// Accept the offer of clients on this host to write their bulk messages into a
+			// ring in shared memory, see shared_memory_ring. Each ring is read on a thread
+			// of its own
+			void SetSharedMemoryTransport(bool bSharedMemory)
+			{
+				m_bSharedMemory = bSharedMemory;
+			}
+
+			// Counters of the messages received through shared memory
+			shared_memory_stats GetSharedMemoryStats()
+			{
+				shared_memory_stats stats;
+				std::scoped_lock lock(m_SessionMutex);
+				for (const std::unique_ptr<shared_memory_receiver<T>>& receiver : m_SharedMemoryReceivers)
+					stats.received += receiver->GetStats().received;
+				return stats;
+			}
+
+			// Counters of the pool incoming message bodies are read into
+			buffer_pool_stats GetBufferPoolStats() const
+			{
+				return m_BufferPool.GetStats();
+			}
+
+		private:
+			// An acceptor listening next to the main one, with a context of its own
+			struct acceptor_context
+			{
+				asio::io_context context;
+				asio::ip::tcp::acceptor acceptor{ context };
+				std::thread thread;
+			};
+
+			static void OpenAcceptor(asio::ip::tcp::acceptor& acceptor, const asio::ip::tcp::endpoint& endpoint, bool bSharePort)
+			{
+				acceptor.open(endpoint.protocol());
+				acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+				if (bSharePort)
+					acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+				acceptor.bind(endpoint);
+				acceptor.listen(asio::socket_base::max_listen_connections);
+			}
+
+			// Forget a client, letting the server know only once even if several threads
+			// notice it has gone at the same time
+			void RemoveClient(const std::shared_ptr<connection<T>>& client)
+			{
+				if (m_Connections.Remove(client->GetID()))
+				{
+					// Its session token goes with it, datagrams still carrying it are dropped,
+					// and so does the reader of its ring. The reader joins its thread, it is
+					// destroyed once the lock is released
+					std::vector<std::unique_ptr<shared_memory_receiver<T>>> vReceivers;
+					{
+						std::scoped_lock lock(m_SessionMutex);
+						std::vector<uint64_t> vTokens;
+						std::erase_if(m_SessionTokens, [&](const auto& token)
+							{
+								if (token.second.expired() || token.second.lock() == client)
+								{
+									vTokens.push_back(token.first);
+									return true;
+								}
+								return false;
+							});
+
+						for (std::unique_ptr<shared_memory_receiver<T>>& receiver : m_SharedMemoryReceivers)
+							if (std::find(vTokens.begin(), vTokens.end(), receiver->GetToken()) != vTokens.end())
+								vReceivers.push_back(std::move(receiver));
+						std::erase(m_SharedMemoryReceivers, nullptr);
+					}
+
+					// Take its bulk lane down too, if it has one
+					client->Disconnect();
+					OnClientDisconnect(client);
+				}
+			}
+
+			// ASYNC - Wait for the next datagram, and feed it to the receiver
+			void ReceiveDatagram()
+			{
+				m_DatagramSocket.async_receive_from(asio::buffer(m_DatagramBuffer), m_DatagramEndpoint,
+					[this](asio::error_code ec, size_t length)
+					{
+						if (ec == asio::error::operation_aborted || !m_DatagramSocket.is_open())
+							return;
+
+						// Only datagrams carrying the token of a connected client are taken in
+						if (!ec && length >= sizeof(uint64_t))
+						{
+							uint64_t nToken = 0;
+							std::memcpy(&nToken, m_DatagramBuffer.data(), sizeof(nToken));
+							if (FindSession(nToken))
+								m_DatagramReceiver.Receive(m_DatagramBuffer.data(), length);
+							else
+								m_DatagramReceiver.Forget(nToken);
+						}
+
+						ReceiveDatagram();
+					});
+			}
+
+			// Called from within the datagram strand with each message put together. The
+			// lane is lossy anyway, a message that finds the incoming queue full is dropped
+			// like a lost datagram rather than held up behind the application
+			void OnDatagramMessage(uint64_t nToken, message<T>&& msg)
+			{
+				if (std::shared_ptr<connection<T>> client = FindSession(nToken))
+				{
+					owned_message<T> owned{ std::move(client), std::move(msg) };
+					if (!m_MessagesIn.try_push(std::move(owned)))
+						m_BufferPool.Release(std::move(owned.msg.body));
+				}
+				else
+					m_BufferPool.Release(std::move(msg.body));
+			}
+
+			// The connection a session token was handed to, if it is still around
+			std::shared_ptr<connection<T>> FindSession(uint64_t nToken)
+			{
+				std::scoped_lock lock(m_SessionMutex);
+				auto it = m_SessionTokens.find(nToken);
+				if (it == m_SessionTokens.end())
+					return nullptr;
+
+				// A connection that has closed but not been removed yet has no session either
+				std::shared_ptr<connection<T>> client = it->second.lock();
+				return client && client->IsConnected() ? client : nullptr;
+			}
+
+			// Called from within a connection's strand when a session handshake message
+			// arrives on it, see session_step
+			void OnSessionMessage(connection<T>& client, message<T>& msg)
+			{
+				if (msg.body.size() != sizeof(uint64_t) + sizeof(session_step))
+				{
+					client.Disconnect();
+					return;
+				}
+
+				session_step step;
+				uint64_t nToken = 0;
+				msg >> step >> nToken;
+
+				if (step == session_step::open)
+				{
+					// Hand out a token the client's second connection will present, it
+					// also marks the client's datagrams for as long as it is connected
+					{
+						std::scoped_lock lock(m_SessionMutex);
+						std::erase_if(m_SessionTokens, [](const auto& token) { return token.second.expired(); });
+
+						std::random_device random;
+						nToken = (uint64_t(random()) << 32) | random();
+						m_SessionTokens[nToken] = client.shared_from_this();
+					}
+
+					message<T> reply;
+					reply.header.flags = message_flags::session;
+					reply << nToken << session_step::token;
+					client.Send(std::move(reply), message_priority::control);
+				}
+				else if (step == session_step::join)
+				{
+					std::shared_ptr<connection<T>> primary;
+					{
+						std::scoped_lock lock(m_SessionMutex);
+						auto it = m_SessionTokens.find(nToken);
+						if (it != m_SessionTokens.end())
+							primary = it->second.lock();
+					}
+
+					// Unknown token, or one already used, whoever this is they are not getting in
+					if (!primary || primary->HasBulkLane())
+					{
+						client.Disconnect();
+						return;
+					}
+
+					// The connection stops being a client of its own and becomes the bulk
+					// lane of the primary one, which owns it from now on
+					std::shared_ptr<connection<T>> lane = m_Connections.Remove(client.GetID());
+					if (!lane)
+						return;
+
+					lane->SetPrimary(primary);
+					primary->SetBulkLane(std::move(lane));
+				}
+				else if (step == session_step::shared_memory)
+				{
+					// Only the client the token was handed to may offer a ring under it
+					if (!m_bSharedMemory || FindSession(nToken).get() != &client)
+						return;
+
+					try
+					{
+						auto receiver = std::make_unique<shared_memory_receiver<T>>(GetSharedMemoryName(nToken), nToken, client.shared_from_this(), m_MessagesIn, m_BufferPool);
+						{
+							// The client may have been removed while the ring was opened, its
+							// token is gone then and the reader goes with this scope
+							std::scoped_lock lock(m_SessionMutex);
+							if (!m_SessionTokens.contains(nToken))
+								return;
+
+							std::erase_if(m_SharedMemoryReceivers, [](const std::unique_ptr<shared_memory_receiver<T>>& r) { return !r->IsRunning(); });
+							m_SharedMemoryReceivers.push_back(std::move(receiver));
+						}
+
+						message<T> reply;
+						reply.header.flags = message_flags::session;
+						reply << nToken << session_step::shared_memory;
+						client.Send(std::move(reply), message_priority::control);
+
+						std::cout << "[" << client.GetID() << "] Reading Through Shared Memory\n";
+					}
+					catch (std::exception& e)
+					{
+						// The client keeps sending datagrams, nothing is lost
+						std::cout << "[" << client.GetID() << "] Shared Memory Refused: " << e.what() << "\n";
+					}
 				}
 			}
 
@@ -198,7 +592,8 @@ namespace rpc
 			// This server class should override thse functions to implement
 			// customised functionality
 
-			// Called when a client connects, you can veto the connection by returning false
+			// Called when a client connects, you can veto the connection by returning false.
+			// With several acceptors this may be called from several threads at once
 			virtual bool OnClientConnect(std::shared_ptr<connection<T>> client)
 			{
 				return false;
@@ -216,23 +611,83 @@ namespace rpc
 
 			}
 
+			// When the message being handled by OnMessage was received, rather than
+			// when Update got round to it
+			std::chrono::steady_clock::time_point GetMessageTime() const
+			{
+				return m_MessageReceived;
+			}
+
+			// Called from an asio thread each time a chunk of a large message arrives, so
+			// the part received so far can be used before the whole message is in. With
+			// several context threads, calls for different clients may run concurrently
+			virtual void OnMessageProgress(std::shared_ptr<connection<T>> client, const message_header<T>& header, const stream_progress& progress)
+			{
 
-		protected:
-			// Thread Safe Queue for incoming message packets
-			tsdeque<owned_message<T>> m_MessagesIn;
+			}
 
-			// Container of active validated connections
-			std::deque<std::shared_ptr<connection<T>>> m_Connections;
 
-			// Order of declaration is important - it is also the order of initialisation
+		protected:
+			// Order of declaration is important - it is also the order of initialisation.
+			// The context is declared first so it is destroyed last, the sockets of
+			// connections still referenced below must go before it does
 			asio::io_context m_AsioContext;
-			std::thread m_ThreadContext;
+
+			// Pool of incoming message bodies, shared by all connections. Declared
+			// before anything that may still hold one of its buffers, so it outlives them.
+			// Each size class keeps at most a full incoming queue of idle buffers, and all
+			// of them together at most MaxIdleBufferBytes
+			static constexpr size_t IncomingQueueSize = 4096;
+			static constexpr size_t MaxIdleBufferBytes = 64 * 1024 * 1024;
+			buffer_pool m_BufferPool{ IncomingQueueSize, MaxIdleBufferBytes };
+
+			// Lock-free queue for incoming message packets, filled by the asio context
+			mpsc_queue<owned_message<T>> m_MessagesIn{ IncomingQueueSize };
+
+			// Messages taken out of the incoming queue by the current Update
+			std::vector<owned_message<T>> m_MessagesBatch;
+			std::chrono::steady_clock::time_point m_MessageReceived;
+
+			// Registry of active validated connections, safe to use from any thread
+			connection_registry<T> m_Connections;
+
+			// Session tokens handed out and not yet presented, with the connection
+			// that asked for each
+			std::mutex m_SessionMutex;
+			std::unordered_map<uint64_t, std::weak_ptr<connection<T>>> m_SessionTokens;
+
+			// Datagram transport, its socket lives on a strand of its own
+			static constexpr int DatagramSocketBufferSize = 4 * 1024 * 1024;
+			bool m_bDatagrams = false;
+			asio::ip::udp::socket m_DatagramSocket{ asio::make_strand(m_AsioContext) };
+			asio::ip::udp::endpoint m_DatagramEndpoint;
+			std::array<uint8_t, 2048> m_DatagramBuffer = {};
+			datagram_receiver<T> m_DatagramReceiver{ m_BufferPool,
+				[this](uint64_t nToken, message<T>&& msg) { OnDatagramMessage(nToken, std::move(msg)); } };
+
+			// Shared memory transport, one reader per client on this host that offered a
+			// ring, kept under the session mutex
+			bool m_bSharedMemory = false;
+			std::vector<std::unique_ptr<shared_memory_receiver<T>>> m_SharedMemoryReceivers;
+
+			std::vector<std::thread> m_ThreadContexts;
+			size_t m_nThreadCount = 1;
 
 			// These things need an asio context
 			asio::ip::tcp::acceptor m_AsioAcceptor; // Handles new incoming connection attempts...
+			uint16_t m_nPort = 0;
+
+			// ...helped by these when several acceptors share the port
+			std::vector<std::unique_ptr<acceptor_context>> m_AcceptorContexts;
+			size_t m_nAcceptorCount = 1;
+
+			// Clients will be identified in the "wider system" via an ID, handed
+			// out by whichever acceptor takes the connection
+			std::atomic<uint32_t> m_IDCounter = 10000;
 
-			// Clients will be identified in the "wider system" via an ID
-			uint32_t m_IDCounter = 10000;
+			// How new connections read incoming bytes, and send large messages
+			typename connection<T>::read_mode m_ReadMode = connection<T>::read_mode::exact;
+			size_t m_ChunkSize = 64 * 1024;
 		};
 	}
 }
\ No newline at end of file
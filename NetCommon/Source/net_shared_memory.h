@@ -0,0 +1,521 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_mpsc_queue.h"
+#include "net_buffer_pool.h"
+#include "net_connection.h"
+
+#if defined(PLATFORM_LINUX)
+	#include <climits>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <linux/futex.h>
+#elif defined(PLATFORM_WINDOWS)
+	#include <windows.h>
+#endif
+
+namespace rpc
+{
+	namespace net
+	{
+		// When the server turns out to be on the same host, a client in session mode can
+		// send what it would send as datagrams through a ring buffer in memory shared with
+		// the server instead. A message then costs one copy into the ring and one out of it
+		// on the other side, and never goes through the network stack at all.
+		//
+		// The ring has a single writer, the client, and a single reader, a thread the
+		// server runs for it. Every record is a message_header followed by the body, and
+		// may wrap around the end of the ring. The reader sleeps on a futex in the shared
+		// memory while the ring is empty (on a named event on Windows), and the writer only
+		// wakes it when it is asleep, so a busy ring does not go to the kernel at all.
+		//
+		// The shared memory starts with this header, the ring itself follows it
+		struct shared_memory_ring
+		{
+			static constexpr uint32_t Magic = 0x52504352;
+
+			uint32_t magic = 0;
+			// Size of the message header of every record, both sides must agree on it
+			uint32_t recordHeaderSize = 0;
+			// Size of the ring, a power of two
+			uint64_t capacity = 0;
+
+			// Written by the writer: how many bytes it has written so far, a counter it
+			// bumps to wake the reader, and whether it has gone
+			alignas(64) std::atomic<uint64_t> head = 0;
+			std::atomic<uint32_t> signal = 0;
+			std::atomic<uint32_t> closed = 0;
+
+			// Written by the reader: how many bytes it has read so far, and whether it
+			// is asleep waiting for more
+			alignas(64) std::atomic<uint64_t> tail = 0;
+			std::atomic<uint32_t> sleeping = 0;
+		};
+
+		static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32 bit integers");
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "Ring positions are shared between processes, they must be lock free");
+
+		struct shared_memory_stats
+		{
+			// Sender side
+			uint64_t sent = 0;
+			uint64_t dropped = 0;
+			// Receiver side, discarded messages were still waiting for room in the incoming
+			// queue when the reader stopped
+			uint64_t received = 0;
+			uint64_t discarded = 0;
+		};
+
+		// Name of the shared memory a session's ring lives in, the random session token
+		// keeps it from clashing with anyone else's
+		inline std::string GetSharedMemoryName(uint64_t nToken)
+		{
+			char name[40];
+#if defined(PLATFORM_WINDOWS)
+			std::snprintf(name, sizeof(name), "Local\\rpc-net-%016llx", static_cast<unsigned long long>(nToken));
+#else
+			std::snprintf(name, sizeof(name), "/rpc-net-%016llx", static_cast<unsigned long long>(nToken));
+#endif
+			return name;
+		}
+
+		// A named block of memory shared between processes, unmapped when this goes. Linux
+		// and Windows have one, elsewhere it always fails to open and messages keep going
+		// the way they did before
+		class shared_memory_region
+		{
+		public:
+			// Create a region of "nSize" bytes under a name nobody uses yet, or open the one
+			// another process created, taking its name away so nobody else can. Throws if
+			// the region cannot be had
+			shared_memory_region(const std::string& name, size_t nSize, bool bCreate)
+			{
+#if defined(PLATFORM_LINUX)
+				// Only the user that created it may open it
+				int fd = shm_open(name.c_str(), bCreate ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, S_IRUSR | S_IWUSR);
+				if (fd < 0)
+					throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+
+				if (bCreate)
+					m_Name = name;
+				else
+					shm_unlink(name.c_str());
+
+				struct stat info = {};
+				if ((bCreate && ftruncate(fd, static_cast<off_t>(nSize)) != 0) || fstat(fd, &info) != 0)
+				{
+					int error = errno;
+					close(fd);
+					Unlink();
+					throw std::system_error(error, std::generic_category(), "shm size " + name);
+				}
+
+				m_nSize = static_cast<size_t>(info.st_size);
+				void* pData = mmap(nullptr, m_nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
+				if (pData == MAP_FAILED)
+				{
+					int error = errno;
+					Unlink();
+					throw std::system_error(error, std::generic_category(), "mmap " + name);
+				}
+				m_pData = pData;
+#elif defined(PLATFORM_WINDOWS)
+				// Backed by the paging file, the mapping goes with the last handle to it.
+				// Windows cannot take a name away once opened, the random token in it and
+				// the session it was handed over on are what keep anyone else out
+				if (bCreate)
+				{
+					ULARGE_INTEGER size;
+					size.QuadPart = nSize;
+					m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, name.c_str());
+					if (m_hMapping && GetLastError() == ERROR_ALREADY_EXISTS)
+					{
+						CloseHandle(m_hMapping);
+						m_hMapping = nullptr;
+						SetLastError(ERROR_ALREADY_EXISTS);
+					}
+				}
+				else
+					m_hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+				if (!m_hMapping)
+					throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "file mapping " + name);
+
+				// A futex cannot be shared between processes here, the reader sleeps on an
+				// auto reset event named after the mapping instead
+				std::string event = name + "-signal";
+				m_hEvent = bCreate ? CreateEventA(nullptr, FALSE, FALSE, event.c_str()) : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, event.c_str());
+				if (!m_hEvent)
+				{
+					DWORD error = GetLastError();
+					Close();
+					throw std::system_error(static_cast<int>(error), std::system_category(), "event " + event);
+				}
+
+				m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+				if (!m_pData)
+				{
+					DWORD error = GetLastError();
+					Close();
+					throw std::system_error(static_cast<int>(error), std::system_category(), "MapViewOfFile " + name);
+				}
+
+				// The view of a mapping someone else created is as big as they made it,
+				// rounded up to whole pages
+				MEMORY_BASIC_INFORMATION info = {};
+				VirtualQuery(m_pData, &info, sizeof(info));
+				m_nSize = bCreate ? nSize : info.RegionSize;
+#else
+				throw std::runtime_error("Shared memory is not supported on this platform");
+#endif
+			}
+
+			shared_memory_region(const shared_memory_region&) = delete;
+
+			~shared_memory_region()
+			{
+#if defined(PLATFORM_LINUX)
+				munmap(m_pData, m_nSize);
+				Unlink();
+#elif defined(PLATFORM_WINDOWS)
+				Close();
+#endif
+			}
+
+		public:
+			void* GetData() const
+			{
+				return m_pData;
+			}
+
+			size_t GetSize() const
+			{
+				return m_nSize;
+			}
+
+			// Sleep while "word" still holds "value", for at most "timeout". The word must be
+			// in this region
+			void Wait(std::atomic<uint32_t>& word, uint32_t value, std::chrono::milliseconds timeout) const
+			{
+#if defined(PLATFORM_LINUX)
+				timespec ts = { static_cast<time_t>(timeout.count() / 1000), static_cast<long>(timeout.count() % 1000) * 1000000 };
+				syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &ts, nullptr, 0);
+#elif defined(PLATFORM_WINDOWS)
+				// A wake since "value" was read has left the event set, it is not lost
+				if (word.load() == value)
+					WaitForSingleObject(m_hEvent, static_cast<DWORD>(timeout.count()));
+#endif
+			}
+
+			// Wake whoever sleeps on "word", there is only ever the reader
+			void Wake(std::atomic<uint32_t>& word) const
+			{
+#if defined(PLATFORM_LINUX)
+				syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(PLATFORM_WINDOWS)
+				SetEvent(m_hEvent);
+#endif
+			}
+
+		private:
+			// The creator takes the name away when it goes, in case nobody ever opened it
+			void Unlink()
+			{
+#if defined(PLATFORM_LINUX)
+				if (!m_Name.empty())
+					shm_unlink(m_Name.c_str());
+				m_Name.clear();
+#endif
+			}
+
+#if defined(PLATFORM_WINDOWS)
+			void Close()
+			{
+				if (m_pData)
+					UnmapViewOfFile(m_pData);
+				if (m_hEvent)
+					CloseHandle(m_hEvent);
+				if (m_hMapping)
+					CloseHandle(m_hMapping);
+				m_pData = nullptr;
+				m_hEvent = nullptr;
+				m_hMapping = nullptr;
+			}
+#endif
+
+		private:
+			std::string m_Name;
+			void* m_pData = nullptr;
+			size_t m_nSize = 0;
+#if defined(PLATFORM_WINDOWS)
+			HANDLE m_hMapping = nullptr;
+			HANDLE m_hEvent = nullptr;
+#endif
+		};
+
+		// Writes messages into a ring shared with the server, straight from the calling thread
+		template<typename T>
+		class shared_memory_sender
+		{
+		public:
+			shared_memory_sender(const std::string& name, size_t nCapacity)
+				: m_nCapacity(std::bit_ceil(std::max<size_t>(nCapacity, 64 * 1024))),
+				  m_Region(name, sizeof(shared_memory_ring) + m_nCapacity, true)
+			{
+				m_pRing = new (m_Region.GetData()) shared_memory_ring();
+				m_pRing->recordHeaderSize = sizeof(message_header<T>);
+				m_pRing->capacity = m_nCapacity;
+				m_pRing->magic = shared_memory_ring::Magic;
+				m_pData = reinterpret_cast<uint8_t*>(m_pRing + 1);
+			}
+
+			shared_memory_sender(const shared_memory_sender<T>&) = delete;
+
+			~shared_memory_sender()
+			{
+				// Tell the reader nothing more is coming, it lets go of its side then
+				m_pRing->closed.store(1);
+				m_pRing->signal.fetch_add(1);
+				m_Region.Wake(m_pRing->signal);
+			}
+
+		public:
+			// Write a message into the ring, returns false if it is too large to ever fit.
+			// A message that does not fit right now, while the reader catches up, is dropped
+			// and replaced by the next one, just like a lost datagram. Unless it must not be
+			// lost, then it is not written and false is returned too, see Fits
+			bool Send(const shared_message<T>& msg, bool bDropWhenFull = true)
+			{
+				std::scoped_lock lock(m_Mutex);
+
+				size_t nSize = msg.size();
+				size_t nRecord = sizeof(message_header<T>) + nSize;
+				if (nSize > UINT32_MAX || nRecord > m_nCapacity)
+					return false;
+
+				uint64_t nHead = m_pRing->head.load(std::memory_order_relaxed);
+				uint64_t nTail = m_pRing->tail.load(std::memory_order_acquire);
+				if (m_nCapacity - (nHead - nTail) < nRecord)
+				{
+					if (!bDropWhenFull)
+						return false;
+
+					m_nDropped++;
+					return true;
+				}
+
+				message_header<T> header = msg.header;
+				header.size = static_cast<uint32_t>(nSize);
+				Write(nHead, &header, sizeof(header));
+				if (nSize > 0)
+					Write(nHead + sizeof(header), msg.body->data(), nSize);
+
+				// Publish the whole record at once, then only wake the reader if it went to
+				// sleep. It checks the head again after saying so, so one of the two always
+				// sees the other
+				m_pRing->head.store(nHead + nRecord);
+				if (m_pRing->sleeping.load())
+				{
+					m_pRing->signal.fetch_add(1);
+					m_Region.Wake(m_pRing->signal);
+				}
+
+				m_nSent++;
+				return true;
+			}
+
+			// True if the message fits the ring once the reader has caught up
+			bool Fits(const shared_message<T>& msg) const
+			{
+				return msg.size() <= UINT32_MAX && sizeof(message_header<T>) + msg.size() <= m_nCapacity;
+			}
+
+			shared_memory_stats GetStats() const
+			{
+				shared_memory_stats stats;
+				stats.sent = m_nSent.load();
+				stats.dropped = m_nDropped.load();
+				return stats;
+			}
+
+		private:
+			void Write(uint64_t nPosition, const void* pSource, size_t nLength)
+			{
+				size_t nOffset = static_cast<size_t>(nPosition & (m_nCapacity - 1));
+				size_t nFirst = std::min(nLength, m_nCapacity - nOffset);
+				std::memcpy(m_pData + nOffset, pSource, nFirst);
+				std::memcpy(m_pData, static_cast<const uint8_t*>(pSource) + nFirst, nLength - nFirst);
+			}
+
+		private:
+			std::mutex m_Mutex;
+			size_t m_nCapacity = 0;
+			shared_memory_region m_Region;
+			shared_memory_ring* m_pRing = nullptr;
+			uint8_t* m_pData = nullptr;
+
+			std::atomic<uint64_t> m_nSent = 0;
+			std::atomic<uint64_t> m_nDropped = 0;
+		};
+
+		// Reads the ring a client shares with the server on a thread of its own, and puts
+		// every message into the server's incoming queue as if it came from the client's
+		// connection. It stops once the client closes the ring or its connection goes
+		template<typename T>
+		class shared_memory_receiver
+		{
+		public:
+			shared_memory_receiver(const std::string& name, uint64_t nToken, std::shared_ptr<connection<T>> remote, mpsc_queue<owned_message<T>>& qIn, buffer_pool& pool)
+				: m_Region(name, 0, false), m_nToken(nToken), m_Remote(remote), m_qMessagesIn(qIn), m_BufferPool(pool)
+			{
+				// The other side may be anyone able to open the memory, trust nothing about
+				// it beyond what is checked here, and keep a copy of what is
+				m_pRing = static_cast<shared_memory_ring*>(m_Region.GetData());
+				if (m_Region.GetSize() < sizeof(shared_memory_ring) || m_pRing->magic != shared_memory_ring::Magic || m_pRing->recordHeaderSize != sizeof(message_header<T>))
+					throw std::runtime_error("Shared memory ring is not valid");
+
+				m_nCapacity = static_cast<size_t>(m_pRing->capacity);
+				if (!std::has_single_bit(m_nCapacity) || m_nCapacity > m_Region.GetSize() - sizeof(shared_memory_ring))
+					throw std::runtime_error("Shared memory ring is not valid");
+
+				m_pData = reinterpret_cast<const uint8_t*>(m_pRing + 1);
+				m_Thread = std::thread([this]() { Run(); });
+			}
+
+			shared_memory_receiver(const shared_memory_receiver<T>&) = delete;
+
+			~shared_memory_receiver()
+			{
+				m_bStop = true;
+				m_pRing->signal.fetch_add(1);
+				m_Region.Wake(m_pRing->signal);
+				if (m_Thread.joinable())
+					m_Thread.join();
+			}
+
+		public:
+			// False once the ring has been closed, or turned out to be broken
+			bool IsRunning() const
+			{
+				return !m_bDone;
+			}
+
+			// Session token of the client the ring belongs to
+			uint64_t GetToken() const
+			{
+				return m_nToken;
+			}
+
+			shared_memory_stats GetStats() const
+			{
+				shared_memory_stats stats;
+				stats.received = m_nReceived.load();
+				stats.discarded = m_nDiscarded.load();
+				return stats;
+			}
+
+		private:
+			void Run()
+			{
+				uint64_t nTail = m_pRing->tail.load(std::memory_order_relaxed);
+				while (!m_bStop)
+				{
+					std::shared_ptr<connection<T>> remote = m_Remote.lock();
+					if (!remote || !remote->IsConnected() || m_pRing->closed.load())
+						break;
+
+					uint64_t nHead = m_pRing->head.load(std::memory_order_acquire);
+					if (nHead == nTail)
+					{
+						Sleep(nTail);
+						continue;
+					}
+
+					// Records are only ever published whole, anything else means the ring
+					// has been scribbled on and is not worth reading any further
+					message_header<T> header;
+					uint64_t nAvailable = nHead - nTail;
+					if (nAvailable > m_nCapacity || nAvailable < sizeof(header))
+						break;
+					Read(nTail, &header, sizeof(header));
+					if (header.size > nAvailable - sizeof(header))
+						break;
+
+					// Messages go through the ring whole, flags only mean something to the
+					// reader of a connection
+					message<T> msg;
+					msg.header = header;
+					msg.header.flags = 0;
+					msg.body = m_BufferPool.Acquire(header.size);
+					if (header.size > 0)
+						Read(nTail + sizeof(header), msg.body.data(), header.size);
+
+					// Not every message in the ring may be lost. When the application is
+					// behind, the record stays in the ring until the incoming queue has room,
+					// and the writer drops or holds back whatever does not fit behind it
+					owned_message<T> owned{ remote, std::move(msg) };
+					while (!m_qMessagesIn.try_push(std::move(owned)))
+					{
+						if (m_bStop || !remote->IsConnected())
+						{
+							m_BufferPool.Release(std::move(owned.msg.body));
+							m_nDiscarded++;
+							m_bDone = true;
+							return;
+						}
+						std::this_thread::sleep_for(IncomingQueueRetry);
+					}
+					m_nReceived++;
+
+					// The space is the writer's again once the record is queued
+					nTail += sizeof(header) + header.size;
+					m_pRing->tail.store(nTail, std::memory_order_release);
+				}
+				m_bDone = true;
+			}
+
+			// Sleep until the writer says there is more. Waking up now and then lets the
+			// thread notice the connection has gone even if the writer never says anything
+			void Sleep(uint64_t nTail)
+			{
+				m_pRing->sleeping.store(1);
+				uint32_t nSignal = m_pRing->signal.load();
+				if (m_pRing->head.load() == nTail && !m_bStop)
+					m_Region.Wait(m_pRing->signal, nSignal, std::chrono::milliseconds(100));
+				m_pRing->sleeping.store(0);
+			}
+
+			void Read(uint64_t nPosition, void* pDestination, size_t nLength) const
+			{
+				size_t nOffset = static_cast<size_t>(nPosition & (m_nCapacity - 1));
+				size_t nFirst = std::min(nLength, m_nCapacity - nOffset);
+				std::memcpy(pDestination, m_pData + nOffset, nFirst);
+				std::memcpy(static_cast<uint8_t*>(pDestination) + nFirst, m_pData, nLength - nFirst);
+			}
+
+		private:
+			shared_memory_region m_Region;
+			shared_memory_ring* m_pRing = nullptr;
+			const uint8_t* m_pData = nullptr;
+			size_t m_nCapacity = 0;
+
+			// How long the reader waits before trying a full incoming queue again
+			static constexpr std::chrono::milliseconds IncomingQueueRetry{ 1 };
+
+			uint64_t m_nToken = 0;
+			std::weak_ptr<connection<T>> m_Remote;
+			mpsc_queue<owned_message<T>>& m_qMessagesIn;
+			buffer_pool& m_BufferPool;
+
+			std::atomic<bool> m_bStop = false;
+			std::atomic<bool> m_bDone = false;
+			std::atomic<uint64_t> m_nReceived = 0;
+			std::atomic<uint64_t> m_nDiscarded = 0;
+			std::thread m_Thread;
+		};
+	}
+}
\ No newline at end of file
@@ -50,6 +50,15 @@ namespace rpc
 			m_BlockingCondionVariable.notify_one();
 		}
 
+		void push_back(T&& item)
+		{
+			std::scoped_lock lock(m_DequeMutex);
+			m_Deque.emplace_back(std::move(item));
+
+			std::unique_lock<std::mutex> ul(m_BlockingMutex);
+			m_BlockingCondionVariable.notify_one();
+		}
+
 		void push_front(const T& item)
 		{
 			std::scoped_lock lock(m_DequeMutex);
@@ -2,7 +2,15 @@
 
 #include "net_connection.h"
 #include "net_tsdeque.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
+#include "net_buffer_pool.h"
+#include "net_handler_alloc.h"
+#include "net_connection_registry.h"
+#include "net_datagram.h"
+#include "net_shared_memory.h"
+#include "net_backoff.h"
+#include "net_connector.h"
 #include "net_common.h"
 #include "net_client.h"
 #include "net_server.h"
\ No newline at end of file
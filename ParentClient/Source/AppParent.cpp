@@ -1,7 +1,10 @@
 #define YK_ENABLE_DEBUG_LOG
 #define YK_ENABLE_DEBUG_PROFILING_LOG
 
+#include <algorithm>
+
 #include <rpc_core.h>
+#include <YKLib.h>
 
 #include "Core/ParentNetClient.h"
 #include "Core/Renderer.h"
@@ -16,30 +19,55 @@ int main()
 
   while (renderer.IsRunning())
   {
-    netClient.Update(1, false);
+    netClient.Update();
 
-    renderer.Clear();
+    std::vector<std::shared_ptr<rpc::ChildSession>> children = netClient.GetChildren();
 
-    if (netClient.ClientConnected())
+    // Tab walks through the children, the quality keys apply to the selected one.
+    // Setting the quality by hand takes the child out of automatic mode, A toggles it
+    if (!children.empty())
     {
+      g_selectedChild %= children.size();
+      std::shared_ptr<rpc::ChildSession> selected = children[g_selectedChild];
+
+      if (g_autoQualityToggle)
       {
-        std::lock_guard<std::mutex> lock(g_frameQualityMutex);
-        if (g_frameQuality != g_newFrameQuality)
-        {
-          netClient.ChangeFrameQuality(g_newFrameQuality);
-          g_frameQuality = g_newFrameQuality;
-        }
+        selected->autoQuality = !selected->autoQuality;
+        selected->qualityController.SetQuality(selected->requestedFrameQuality);
+        YK_INFO("[QUALITY] Child '{}' automatic quality {}", selected->connection->GetID(), selected->autoQuality ? "on" : "off");
       }
+      if (g_frameQualityReset || g_frameQualitySteps != 0)
+        selected->autoQuality = false;
 
-      if (netClient.NewFrameAvailable())
+      int32_t quality = static_cast<int32_t>(selected->requestedFrameQuality);
+      if (g_frameQualityReset)
+        quality = 50;
+      if (g_frameQualitySteps != 0)
+        quality = quality - quality % 5 + g_frameQualitySteps * 5;
+      quality = std::clamp(quality, 1, 100);
+
+      if (!selected->autoQuality && static_cast<uint32_t>(quality) != selected->requestedFrameQuality)
       {
-        renderer.UpdateTexture();
+        netClient.ChangeFrameQuality(selected->connection->GetID(), quality);
+        selected->qualityController.SetQuality(quality);
       }
-
-      renderer.Render();
     }
-    
+    g_frameQualityReset = false;
+    g_frameQualitySteps = 0;
+    g_autoQualityToggle = false;
+
+    netClient.UpdateFrameQualities();
+    netClient.PingChildren();
+
+    std::vector<std::shared_ptr<rpc::ChildFrame>> frames;
+    frames.reserve(children.size());
+    for (const std::shared_ptr<rpc::ChildSession>& child : children)
+      frames.push_back(child->frame);
+
+    renderer.Clear();
+    renderer.Render(frames, g_selectedChild);
     renderer.Update();
+    netClient.UpdateDisplayLatencies();
   }
 
   netClient.Stop();
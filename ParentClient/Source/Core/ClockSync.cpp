@@ -0,0 +1,48 @@
+#include "Core/ClockSync.h"
+
+namespace rpc
+{
+  void ClockSync::OnPong(uint64_t pingSent, uint64_t pingReceived, uint64_t pongSent, uint64_t pongReceived)
+  {
+    Sample sample;
+    sample.roundTrip = static_cast<int64_t>(pongReceived - pingSent) - static_cast<int64_t>(pongSent - pingReceived);
+    sample.offset = (static_cast<int64_t>(pingReceived - pingSent) + static_cast<int64_t>(pongSent - pongReceived)) / 2;
+
+    // Clocks running at slightly different rates drift apart, old samples are
+    // overwritten so the offset keeps up
+    m_Last = m_SampleCount % m_Samples.size();
+    m_Samples[m_Last] = sample;
+    m_SampleCount++;
+
+    size_t count = m_SampleCount < m_Samples.size() ? m_SampleCount : m_Samples.size();
+    m_Best = 0;
+    for (size_t i = 1; i < count; i++)
+      if (m_Samples[i].roundTrip < m_Samples[m_Best].roundTrip)
+        m_Best = i;
+  }
+
+  bool ClockSync::IsSynced() const
+  {
+    return m_SampleCount > 0;
+  }
+
+  int64_t ClockSync::GetOffset() const
+  {
+    return m_Samples[m_Best].offset;
+  }
+
+  double ClockSync::GetRoundTrip() const
+  {
+    return m_Samples[m_Best].roundTrip / 1000.0;
+  }
+
+  double ClockSync::GetLastRoundTrip() const
+  {
+    return m_Samples[m_Last].roundTrip / 1000.0;
+  }
+
+  uint64_t ClockSync::ToLocalTime(uint64_t remoteTime) const
+  {
+    return remoteTime - static_cast<uint64_t>(GetOffset());
+  }
+}
\ No newline at end of file
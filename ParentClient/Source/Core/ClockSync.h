@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace rpc
+{
+  // Works out how far a child's clock is from the parent's, NTP style. The parent
+  // stamps a ping when it leaves (t1), the child when it arrives (t2) and when the
+  // pong leaves (t3), the parent again when the pong arrives (t4). Then
+  //   round trip = (t4 - t1) - (t3 - t2)
+  //   offset     = ((t2 - t1) + (t3 - t4)) / 2
+  // The offset is only exact if both directions took as long, which is most likely
+  // for the quickest round trips, so the one of the last few is trusted.
+  class ClockSync
+  {
+  public:
+    void OnPong(uint64_t pingSent, uint64_t pingReceived, uint64_t pongSent, uint64_t pongReceived);
+
+    bool IsSynced() const;
+
+    // Child clock minus parent clock, in microseconds
+    int64_t GetOffset() const;
+    // Of the trusted sample, and of the latest one, in milliseconds
+    double GetRoundTrip() const;
+    double GetLastRoundTrip() const;
+
+    // A timestamp of the child's clock, on the parent's
+    uint64_t ToLocalTime(uint64_t remoteTime) const;
+
+  private:
+    struct Sample
+    {
+      int64_t roundTrip = 0;
+      int64_t offset = 0;
+    };
+
+    std::array<Sample, 8> m_Samples;
+    size_t m_SampleCount = 0;
+    size_t m_Best = 0;
+    size_t m_Last = 0;
+  };
+}
\ No newline at end of file
@@ -4,18 +4,28 @@
 #include <vector>
 #include <mutex>
 
-// Current
-extern std::mutex g_framePixelsMutex;
-extern std::vector<uint8_t> g_framePixelsData;
+namespace rpc
+{
+  // Latest decoded frame of one child, written by its decode thread and read by the renderer
+  struct ChildFrame
+  {
+    uint32_t id = 0;
 
-extern std::mutex g_frameSizeMutex;
-extern uint32_t g_frameHeight;
-extern uint32_t g_frameWidth;
+    std::mutex mutex;
+    std::vector<uint8_t> pixels;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool newFrame = false;
 
-extern std::mutex g_frameQualityMutex;
-extern uint32_t g_frameQuality;
+    // When the child captured the pixels, on the parent's clock (zero if unknown),
+    // and of the frame the renderer last took up, until its latency is measured
+    uint64_t captureTime = 0;
+    uint64_t presentedCaptureTime = 0;
+  };
+}
 
-// Temp
-extern uint32_t g_newFrameQuality;
-extern uint32_t g_currentFrameWidth;
-extern uint32_t g_currentFrameHeight;
\ No newline at end of file
+// Input, set by the renderer's key callback and applied by the main loop
+extern uint32_t g_selectedChild;
+extern int32_t g_frameQualitySteps;
+extern bool g_frameQualityReset;
+extern bool g_autoQualityToggle;
\ No newline at end of file
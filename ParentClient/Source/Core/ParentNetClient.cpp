@@ -5,115 +5,333 @@
 
 namespace rpc
 {
+  ChildSession::ChildSession(std::shared_ptr<net::connection<net::message_type>> client)
+    : connection(std::move(client))
+  {
+    frame->id = connection->GetID();
+
+    decompressor = tjInitDecompress();
+    YK_ASSERT(decompressor, "[SCREEN RECORDER] TurboJPEG error: failed to initialize the decompressor");
+  }
+
+  ChildSession::~ChildSession()
+  {
+    tjDestroy(decompressor);
+  }
+
   ParentClient::ParentClient(uint16_t port) 
     : net::ServerInterface<net::message_type>(port) 
   {
-    m_Decompressor = tjInitDecompress();
-    YK_ASSERT(m_Decompressor, "[SCREEN RECORDER] TurboJPEG error: failed to initialize the decompressor");
+    // Frames arrive next to many small control messages, read them in large chunks
+    SetReadMode(net::connection<net::message_type>::read_mode::buffered);
+
+    // Every connected child is read and written on whichever of these threads is free
+    SetThreadCount(std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+
+    // A whole room of children reconnects at once when the parent restarts
+    SetAcceptorCount(2);
+
+    // Children send their frames as datagrams, or through shared memory when they
+    // run on this same machine
+    SetDatagramTransport(true);
+    SetSharedMemoryTransport(true);
   }
 
   ParentClient::~ParentClient()
   {
-    tjDestroy(m_Decompressor);
+    // Frames still decoding use the buffer pool and the children, both go with the parent
+    for (DecodeThread& decode : m_DecodeThreads)
+      decode.thread.join();
   }
 
-  void ParentClient::ChangeFrameQuality(uint32_t quality)
+  void ParentClient::ChangeFrameQuality(uint32_t id, uint32_t quality)
   {
+    auto it = m_Children.find(id);
+    if (it == m_Children.end())
+      return;
+
+    std::shared_ptr<ChildSession> child = it->second;
+    child->requestedFrameQuality = quality;
+
     net::message<net::message_type> msg;
     msg.header.id = net::message_type::server_frame_quality_change;
 
     msg << quality;
-    ParentClient::MessageClient(m_ConnectedClient, msg);
+    ParentClient::MessageClient(child->connection, std::move(msg), net::message_priority::control);
+  }
+
+  void ParentClient::ChangePacingRate(uint32_t id, uint64_t rate)
+  {
+    auto it = m_Children.find(id);
+    if (it == m_Children.end())
+      return;
+
+    std::shared_ptr<ChildSession> child = it->second;
+    child->pacingRate = rate;
+
+    net::message<net::message_type> msg;
+    msg.header.id = net::message_type::server_pacing_rate_change;
+
+    msg << rate;
+    ParentClient::MessageClient(child->connection, std::move(msg), net::message_priority::control);
   }
 
-  bool ParentClient::NewFrameAvailable()
+  void ParentClient::UpdateFrameQualities()
   {
-    return m_NewFrameAvailable.exchange(false);
+    for (auto& [id, child] : m_Children)
+    {
+      if (!child->autoQuality)
+        continue;
+
+      if (std::optional<uint32_t> quality = child->qualityController.Update())
+        ChangeFrameQuality(id, *quality);
+
+      uint64_t pacingRate = child->qualityController.GetPacingRate();
+      if (pacingRate != child->pacingRate)
+        ChangePacingRate(id, pacingRate);
+    }
+  }
+
+  void ParentClient::PingChildren()
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (auto& [id, child] : m_Children)
+    {
+      if (now - child->lastPing < std::chrono::seconds(1))
+        continue;
+      child->lastPing = now;
+
+      net::message<net::message_type> msg;
+      msg.header.id = net::message_type::server_ping;
+
+      msg << net::timestamp_now();
+      ParentClient::MessageClient(child->connection, std::move(msg), net::message_priority::control);
+    }
+  }
+
+  void ParentClient::UpdateDisplayLatencies()
+  {
+    uint64_t now = net::timestamp_now();
+    for (auto& [id, child] : m_Children)
+    {
+      uint64_t captureTime = 0;
+      {
+        std::lock_guard<std::mutex> lock(child->frame->mutex);
+        std::swap(captureTime, child->frame->presentedCaptureTime);
+      }
+      if (captureTime == 0)
+        continue;
+
+      double latency = static_cast<int64_t>(now - captureTime) / 1000.0;
+      child->displayLatency = child->displayLatency == 0.0 ? latency : child->displayLatency + (latency - child->displayLatency) * 0.1;
+    }
+  }
+
+  std::vector<std::shared_ptr<ChildSession>> ParentClient::GetChildren()
+  {
+    // A connection that closed on its own is only noticed here, the server forgets it
+    // (which detaches the child through OnClientDisconnect)
+    for (auto it = m_Children.begin(); it != m_Children.end();)
+    {
+      uint32_t id = it->first;
+      std::shared_ptr<net::connection<net::message_type>> connection = it->second->connection;
+      ++it;
+
+      if (!connection->IsConnected())
+      {
+        DisconnectClient(connection);
+        DetachChild(id);
+      }
+    }
+
+    // Children that did not come back in time are gone for good
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (auto it = m_DetachedChildren.begin(); it != m_DetachedChildren.end();)
+    {
+      if (now - it->second->detachedTime < ResumeGracePeriod)
+      {
+        ++it;
+        continue;
+      }
+
+      YK_INFO("[NETWORK] Child '{}' did not come back", it->second->frame->id);
+      it = m_DetachedChildren.erase(it);
+    }
+
+    std::vector<std::shared_ptr<ChildSession>> children;
+    children.reserve(m_Children.size() + m_DetachedChildren.size());
+    for (auto& [id, child] : m_Children)
+      children.push_back(child);
+    for (auto& [token, child] : m_DetachedChildren)
+      children.push_back(child);
+
+    // A child that comes back keeps its place, its frame keeps the ID it first had
+    std::sort(children.begin(), children.end(),
+      [](const std::shared_ptr<ChildSession>& a, const std::shared_ptr<ChildSession>& b) { return a->frame->id < b->frame->id; });
+    return children;
   }
 
   bool ParentClient::OnClientConnect(std::shared_ptr<net::connection<net::message_type>> client)
   {
-    m_ConnectedClient = client;
+    // The child gets its ID once accepted, its session is made with its first message
     return true;
   }
 
   void ParentClient::OnClientDisconnect(std::shared_ptr<net::connection<net::message_type>> client)
   {
-    m_ConnectedClient.reset();
+    if (client)
+      DetachChild(client->GetID());
+  }
+
+  std::shared_ptr<ChildSession> ParentClient::GetChild(std::shared_ptr<net::connection<net::message_type>> client)
+  {
+    auto it = m_Children.find(client->GetID());
+    if (it != m_Children.end())
+      return it->second;
+
+    std::shared_ptr<ChildSession> child = std::make_shared<ChildSession>(client);
+    do
+      child->resumeToken = m_Random();
+    while (child->resumeToken == 0);
+
+    m_Children[client->GetID()] = child;
+    YK_INFO("[NETWORK] Child '{}' connected", client->GetID());
+
+    SendResumeToken(*child);
+    return child;
+  }
+
+  void ParentClient::SendResumeToken(ChildSession& child)
+  {
+    net::message<net::message_type> msg;
+    msg.header.id = net::message_type::server_resume_token;
+
+    msg << child.resumeToken;
+    ParentClient::MessageClient(child.connection, std::move(msg), net::message_priority::control);
+  }
+
+  void ParentClient::DetachChild(uint32_t id)
+  {
+    auto it = m_Children.find(id);
+    if (it == m_Children.end())
+      return;
+
+    std::shared_ptr<ChildSession> child = std::move(it->second);
+    m_Children.erase(it);
+
+    child->detachedTime = std::chrono::steady_clock::now();
+    m_DetachedChildren[child->resumeToken] = child;
+    YK_INFO("[NETWORK] Child '{}' disconnected, its session is kept for {}s", id, ResumeGracePeriod.count());
+  }
+
+  bool ParentClient::ResumeChild(std::shared_ptr<net::connection<net::message_type>> client, uint64_t token)
+  {
+    std::shared_ptr<ChildSession> child;
+    if (auto it = m_DetachedChildren.find(token); it != m_DetachedChildren.end())
+    {
+      child = std::move(it->second);
+      m_DetachedChildren.erase(it);
+    }
+    else
+    {
+      // The old connection may not have been noticed as gone yet, a blip on the child's
+      // side often goes unseen here until TCP gives up on it
+      auto attached = std::find_if(m_Children.begin(), m_Children.end(),
+        [&](const auto& entry) { return entry.second->resumeToken == token && entry.second->connection != client; });
+      if (attached == m_Children.end())
+        return false;
+
+      child = std::move(attached->second);
+      m_Children.erase(attached);
+      DisconnectClient(child->connection);
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t away = child->detachedTime == std::chrono::steady_clock::time_point{} ? 0 :
+      std::chrono::duration_cast<std::chrono::milliseconds>(now - child->detachedTime).count();
+    YK_INFO("[NETWORK] Child '{}' resumed its session as '{}', {}ms after losing it", child->connection->GetID(), client->GetID(), away);
+
+    child->connection = client;
+    child->detachedTime = {};
+    child->lastPing = {};
+    m_Children[client->GetID()] = child;
+
+    // Handing the token back confirms the session, then the child gets the quality
+    // and pacing the parent wanted before it went
+    SendResumeToken(*child);
+    ChangeFrameQuality(client->GetID(), child->requestedFrameQuality);
+    if (child->pacingRate > 0)
+      ChangePacingRate(client->GetID(), child->pacingRate);
+    return true;
   }
 
   void ParentClient::OnMessage(std::shared_ptr<net::connection<net::message_type>> client, net::message<net::message_type>& msg)
   {
+    // Whatever was still on its way from a connection that has gone since belongs to no
+    // session any more, its child is detached or already resumed on a new connection
+    if (!client->IsConnected())
+      return;
+
+    // A child back after losing its connection carries on with its session, one whose
+    // session is not known here any more (the parent restarted) starts a new one
+    if (msg.header.id == net::message_type::client_resume)
+    {
+      uint64_t token = 0;
+      msg >> token;
+      if (!ResumeChild(client, token))
+        GetChild(client);
+      return;
+    }
+
+    std::shared_ptr<ChildSession> child = GetChild(client);
+
     switch (msg.header.id)
     {
     case net::message_type::client_frame_data_update:
     {
-      std::lock_guard<std::mutex> lock1(g_frameSizeMutex);
-      std::lock_guard<std::mutex> lock2(g_frameQualityMutex);
-      msg >> g_frameQuality >> g_frameHeight >> g_frameWidth;
+      uint32_t height = 0, width = 0;
+      msg >> child->frameQuality >> height >> width;
+      child->frameHeight = height;
+      child->frameWidth = width;
       break;
     }
     case net::message_type::client_frame_pixels_update:
     {
-      uint64_t size = 0;
-      std::vector<uint8_t> jpegData;
-      msg >> size;
-      msg.pull_back(jpegData, size);
+      uint64_t size = 0, captureTime = 0;
+      msg >> size >> captureTime;
+      if (size != msg.body.size())
+      {
+        YK_WARN("[NETWORK] Invalid frame size '{}', message holds '{}' bytes", size, msg.body.size());
+        break;
+      }
 
-      std::thread([&, jpegData = std::move(jpegData)]()
-        {
-          yk::Timer timer;
-          timer.Start();
-
-          int32_t width, height, jpegSubsamp, jpegColorspace;
-          std::vector<uint8_t> rgbBuffer;
-          {
-            std::lock_guard<std::mutex> lock(m_DecompressorMutex);
-            if (tjDecompressHeader3(m_Decompressor, jpegData.data(), jpegData.size(), &width, &height, &jpegSubsamp, &jpegColorspace) != 0)
-            {
-              YK_ERROR("[SCREEN RECORDER] Compression failed: {}", tjGetErrorStr());
-              return;
-            }
-
-            rgbBuffer.resize(width * height * 3);
-
-            if (tjDecompress2(m_Decompressor, jpegData.data(), jpegData.size(), rgbBuffer.data(), width, 0, height, TJPF_RGB, 0) != 0)
-            {
-              YK_ERROR("[SCREEN RECORDER] Compression failed: {}", tjGetErrorStr());
-              return;
-            }
-          }
-
-          const int rowSize = width * 3;
-          std::vector<uint8_t> tempRow(rowSize);
-          for (int y = 0; y < height / 2; ++y)
-          {
-            uint8_t* rowTop = rgbBuffer.data() + y * rowSize;
-            uint8_t* rowBottom = rgbBuffer.data() + (height - 1 - y) * rowSize;
-
-            std::memcpy(tempRow.data(), rowTop, rowSize);
-            std::memcpy(rowTop, rowBottom, rowSize);
-            std::memcpy(rowBottom, tempRow.data(), rowSize);
-          }
-
-          {
-            std::lock_guard<std::mutex> lock(g_frameSizeMutex);
-            if (g_frameHeight != height || g_frameWidth != width)
-            {
-              YK_WARN("[NETWORK] Invalid image size");
-              return;
-            }
-          }
-
-          {
-            std::lock_guard<std::mutex> lock(g_framePixelsMutex);
-            g_framePixelsData = std::move(rgbBuffer);
-            m_NewFrameAvailable.store(true);
-          }
-
-          YK_INFO("{}ms", static_cast<int32_t>(timer.ElapsedMilliseconds()));
-        }).detach();
-      
+      // Until the child's clock is known the frame can't be timed
+      uint64_t localCaptureTime = child->clock.IsSynced() ? child->clock.ToLocalTime(captureTime) : 0;
+      child->qualityController.OnFrameReceived(msg.body.size(), captureTime, localCaptureTime, net::to_timestamp(GetMessageTime()));
+
+      // Still busy with the previous frame of this child, this one is already stale
+      if (child->decoding.exchange(true))
+        break;
+
+      // What is left of the body is the JPEG itself, take it over instead of copying it
+      DecodeFrame(child, std::move(msg.body), localCaptureTime);
+      break;
+    }
+    case net::message_type::client_stats_update:
+    {
+      uint64_t queuedBytes = 0, droppedFrames = 0, sentFrames = 0;
+      msg >> sentFrames >> droppedFrames >> queuedBytes;
+      child->qualityController.OnChildStats(queuedBytes, droppedFrames, sentFrames);
+      break;
+    }
+    case net::message_type::client_pong:
+    {
+      uint64_t pingTime = 0, receiveTime = 0, pongTime = 0;
+      msg >> pongTime >> receiveTime >> pingTime;
+      child->clock.OnPong(pingTime, receiveTime, pongTime, net::to_timestamp(GetMessageTime()));
+
+      YK_INFO("[NETWORK] Child '{}' round trip {:.2f}ms (best {:.2f}ms), clock offset {}us, capture to display {:.1f}ms",
+        child->connection->GetID(), child->clock.GetLastRoundTrip(), child->clock.GetRoundTrip(), child->clock.GetOffset(), child->displayLatency);
       break;
     }
     case net::message_type::client_input_update:
@@ -128,4 +346,93 @@ namespace rpc
     }
     }
   }
+
+  void ParentClient::DecodeFrame(std::shared_ptr<ChildSession> child, std::vector<uint8_t>&& jpegData, uint64_t captureTime)
+  {
+    // Threads done with their frame are joined here, the others when the parent goes
+    std::erase_if(m_DecodeThreads, [](DecodeThread& decode)
+      {
+        if (!decode.done->load())
+          return false;
+        decode.thread.join();
+        return true;
+      });
+
+    DecodeThread& decode = m_DecodeThreads.emplace_back();
+    decode.thread = std::thread([this, child, captureTime, done = decode.done, jpegData = std::move(jpegData)]() mutable
+      {
+        DecodeJpeg(*child, std::move(jpegData), captureTime);
+        *done = true;
+      });
+  }
+
+  void ParentClient::DecodeJpeg(ChildSession& child, std::vector<uint8_t>&& jpegData, uint64_t captureTime)
+  {
+    yk::Timer timer;
+    timer.Start();
+
+    int32_t width, height, jpegSubsamp, jpegColorspace;
+    std::vector<uint8_t> rgbBuffer;
+    {
+      // However the decode goes, the JPEG's buffer goes back to the network pool and
+      // the child's next frame may be decoded
+      struct DecodeGuard
+      {
+        ParentClient& parent;
+        ChildSession& child;
+        std::vector<uint8_t>& jpegData;
+
+        ~DecodeGuard()
+        {
+          parent.m_BufferPool.Release(std::move(jpegData));
+          child.decoding = false;
+        }
+      } guard{ *this, child, jpegData };
+
+      if (tjDecompressHeader3(child.decompressor, jpegData.data(), jpegData.size(), &width, &height, &jpegSubsamp, &jpegColorspace) != 0)
+      {
+        YK_ERROR("[SCREEN RECORDER] Compression failed: {}", tjGetErrorStr());
+        return;
+      }
+
+      rgbBuffer.resize(width * height * 3);
+
+      if (tjDecompress2(child.decompressor, jpegData.data(), jpegData.size(), rgbBuffer.data(), width, 0, height, TJPF_RGB, 0) != 0)
+      {
+        YK_ERROR("[SCREEN RECORDER] Compression failed: {}", tjGetErrorStr());
+        return;
+      }
+
+      child.qualityController.OnFrameDecoded(timer.ElapsedMilliseconds());
+    }
+
+    const int rowSize = width * 3;
+    std::vector<uint8_t> tempRow(rowSize);
+    for (int y = 0; y < height / 2; ++y)
+    {
+      uint8_t* rowTop = rgbBuffer.data() + y * rowSize;
+      uint8_t* rowBottom = rgbBuffer.data() + (height - 1 - y) * rowSize;
+
+      std::memcpy(tempRow.data(), rowTop, rowSize);
+      std::memcpy(rowTop, rowBottom, rowSize);
+      std::memcpy(rowBottom, tempRow.data(), rowSize);
+    }
+
+    if (child.frameHeight != static_cast<uint32_t>(height) || child.frameWidth != static_cast<uint32_t>(width))
+    {
+      YK_WARN("[NETWORK] Invalid image size");
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(child.frame->mutex);
+      child.frame->pixels = std::move(rgbBuffer);
+      child.frame->width = width;
+      child.frame->height = height;
+      child.frame->captureTime = captureTime;
+      child.frame->newFrame = true;
+    }
+
+    YK_INFO("[NETWORK] Child '{}' frame decoded in {}ms", child.frame->id, static_cast<int32_t>(timer.ElapsedMilliseconds()));
+  }
 }
\ No newline at end of file
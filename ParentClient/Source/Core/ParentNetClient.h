@@ -1,23 +1,77 @@
 #pragma once
 
+#include <map>
+#include <random>
+
 #include <rpc_core.h>
 #include <rpc_net.h>
 #include <turbojpeg.h>
 
+#include "Core/ClockSync.h"
 #include "Core/Common.h"
+#include "Core/QualityController.h"
 
 namespace rpc
 {
+  // Everything the parent keeps about one connected child, keyed by its connection ID
+  struct ChildSession
+  {
+    ChildSession(std::shared_ptr<net::connection<net::message_type>> client);
+    ~ChildSession();
+
+    std::shared_ptr<net::connection<net::message_type>> connection;
+    std::shared_ptr<ChildFrame> frame = std::make_shared<ChildFrame>();
+
+    // Presented by the child when it comes back after losing its connection, see
+    // net::message_type::client_resume. Until then the session is detached, and keeps
+    // showing the last frame
+    uint64_t resumeToken = 0;
+    std::chrono::steady_clock::time_point detachedTime = {};
+
+    // Frame size announced by the child, decoded frames must match it
+    std::atomic<uint32_t> frameWidth = 0;
+    std::atomic<uint32_t> frameHeight = 0;
+
+    // Quality the child last reported, and the one the parent asked for
+    uint32_t frameQuality = 50;
+    uint32_t requestedFrameQuality = 50;
+
+    // Unless set by hand, the quality follows what the link can sustain, and so does
+    // the rate the child paces its frames at
+    QualityController qualityController;
+    bool autoQuality = true;
+    uint64_t pacingRate = 0;
+
+    // Pinged now and then to know the child's clock, so frames can be timed from
+    // capture until they are on screen
+    ClockSync clock;
+    std::chrono::steady_clock::time_point lastPing = {};
+    double displayLatency = 0.0;
+
+    // Each child has its own decoder, a frame arriving while the previous one is
+    // still being decoded is dropped, only the latest frame matters
+    tjhandle decompressor = nullptr;
+    std::atomic<bool> decoding = false;
+  };
+
   class ParentClient : public net::ServerInterface<net::message_type>
   {
   public:
     ParentClient(uint16_t port);
     ~ParentClient();
 
-    void ChangeFrameQuality(uint32_t quality);
+    void ChangeFrameQuality(uint32_t id, uint32_t quality);
+    void ChangePacingRate(uint32_t id, uint64_t rate);
+    // Lets every child in automatic mode have its quality and pacing adjusted, once a frame
+    void UpdateFrameQualities();
+    // Pings the children that are due for it
+    void PingChildren();
+    // Times the frames the renderer just put on screen, call after presenting them
+    void UpdateDisplayLatencies();
 
-    bool ClientConnected() const { return m_ConnectedClient != nullptr; }
-    bool NewFrameAvailable();
+    // Children currently connected, and those that lost their connection recently enough
+    // to come back, ordered by when they first connected. Forgets the others
+    std::vector<std::shared_ptr<ChildSession>> GetChildren();
 
   protected:
     bool OnClientConnect(std::shared_ptr<net::connection<net::message_type>> client) override;
@@ -25,9 +79,33 @@ namespace rpc
     void OnMessage(std::shared_ptr<net::connection<net::message_type>> client, net::message<net::message_type>& msg) override;
 
   private:
-    std::shared_ptr<net::connection<net::message_type>> m_ConnectedClient = nullptr;
-    std::atomic<bool> m_NewFrameAvailable = false;
-    tjhandle m_Decompressor;
-    std::mutex m_DecompressorMutex;
+    std::shared_ptr<ChildSession> GetChild(std::shared_ptr<net::connection<net::message_type>> client);
+    void SendResumeToken(ChildSession& child);
+    // Keeps the session of a child that lost its connection, for it to resume
+    void DetachChild(uint32_t id);
+    // Hands a reconnected child the session its token belongs to, false if there is none
+    bool ResumeChild(std::shared_ptr<net::connection<net::message_type>> client, uint64_t token);
+    // Decodes the frame on a thread of its own, see m_DecodeThreads
+    void DecodeFrame(std::shared_ptr<ChildSession> child, std::vector<uint8_t>&& jpegData, uint64_t captureTime);
+    void DecodeJpeg(ChildSession& child, std::vector<uint8_t>&& jpegData, uint64_t captureTime);
+
+  private:
+    // How long the session of a child that lost its connection is kept for it
+    static constexpr std::chrono::seconds ResumeGracePeriod = std::chrono::seconds(30);
+
+    // Only touched from Update, on the main thread. Connected children by connection ID,
+    // and detached ones by resume token
+    std::map<uint32_t, std::shared_ptr<ChildSession>> m_Children;
+    std::map<uint64_t, std::shared_ptr<ChildSession>> m_DetachedChildren;
+    std::mt19937_64 m_Random{ std::random_device{}() };
+
+    // Frames being decoded, one thread each. Joined once done, by the next DecodeFrame,
+    // and all of them by the destructor. Only touched from the main thread
+    struct DecodeThread
+    {
+      std::thread thread;
+      std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+    };
+    std::vector<DecodeThread> m_DecodeThreads;
   };
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+
+#include <YKLib.h>
+
+#include "Core/QualityController.h"
+
+namespace rpc
+{
+  namespace
+  {
+    constexpr uint32_t MinQuality = 10;
+    constexpr uint32_t MaxQuality = 95;
+    constexpr uint32_t QualityIncrease = 2;
+    constexpr double QualityDecrease = 0.8;
+
+    constexpr std::chrono::milliseconds StepInterval(500);
+    // After backing off, wait this long before trying to climb again
+    constexpr std::chrono::milliseconds DecreaseHold(2000);
+
+    // From capture to arrival, what the quality is chosen to meet
+    constexpr double TargetLatencyMs = 100.0;
+
+    // Past these the link or the parent is not keeping up
+    constexpr double JitterLimitMs = 15.0;
+    constexpr double DecodeBudgetMs = 30.0;
+    constexpr double LossLimit = 0.05;
+
+    // A change in transit time this large is the child reconnecting or its clock jumping,
+    // not jitter, it starts over
+    constexpr double TransitJumpMs = 1000.0;
+    // Loss is only worked out over at least this many frames
+    constexpr uint64_t LossSampleFrames = 20;
+
+    // Weight of a new sample in the moving averages
+    constexpr double Smoothing = 0.1;
+
+    // The child paces its frames a little above the throughput, so it smooths out their
+    // bursts without holding back a rate the link has shown it can take. Changes
+    // smaller than PacingChange are not worth telling the child about
+    constexpr double PacingGain = 1.25;
+    constexpr double PacingChange = 0.1;
+    constexpr double MinPacingRate = 64.0 * 1024.0;
+  }
+
+  QualityController::QualityController(uint32_t quality)
+    : m_Quality(quality)
+  {
+  }
+
+  void QualityController::OnFrameReceived(size_t bytes, uint64_t captureTime, uint64_t localCaptureTime, uint64_t arrivalTime)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // Jitter as RTP does it, the difference between the transit times of two frames. The
+    // offset between the clocks cancels out, so it works before they are synced. A frame
+    // sent again after a reconnect is no newer than the last one, and is left out
+    if (captureTime > m_LastCaptureTime)
+    {
+      int64_t transit = static_cast<int64_t>(arrivalTime - captureTime);
+      if (m_LastCaptureTime != 0)
+      {
+        double differenceMs = std::abs(static_cast<double>(transit - m_LastTransit)) / 1000.0;
+        if (differenceMs < TransitJumpMs)
+          m_JitterMs += (differenceMs - m_JitterMs) * Smoothing;
+      }
+      m_LastCaptureTime = captureTime;
+      m_LastTransit = transit;
+
+      if (localCaptureTime != 0 && arrivalTime > localCaptureTime)
+      {
+        double latencyMs = static_cast<double>(arrivalTime - localCaptureTime) / 1000.0;
+        m_LatencyMs = m_LatencyMs == 0.0 ? latencyMs : m_LatencyMs + (latencyMs - m_LatencyMs) * Smoothing;
+      }
+    }
+
+    m_FrameBytes += (static_cast<double>(bytes) - m_FrameBytes) * Smoothing;
+    m_StepBytes += bytes;
+    m_FramesReceived++;
+  }
+
+  void QualityController::OnFrameDecoded(double decodeMs)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_DecodeMs += (decodeMs - m_DecodeMs) * Smoothing;
+  }
+
+  void QualityController::OnChildStats(uint64_t queuedBytes, uint64_t droppedFrames, uint64_t sentFrames)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ChildQueuedBytes = queuedBytes;
+    m_ChildDroppedFrames = droppedFrames;
+
+    // Counted from the first stats on, and over enough frames that the few still on
+    // their way when the stats left don't count as lost
+    if (!m_HasChildStats || sentFrames < m_LossFramesSent)
+    {
+      m_HasChildStats = true;
+      m_LossFramesSent = sentFrames;
+      m_LossFramesReceived = m_FramesReceived;
+      return;
+    }
+
+    uint64_t sent = sentFrames - m_LossFramesSent;
+    if (sent < LossSampleFrames)
+      return;
+
+    uint64_t received = m_FramesReceived - m_LossFramesReceived;
+    double loss = received >= sent ? 0.0 : static_cast<double>(sent - received) / static_cast<double>(sent);
+    m_LossRate += (loss - m_LossRate) * Smoothing * 3.0;
+    m_LossFramesSent = sentFrames;
+    m_LossFramesReceived = m_FramesReceived;
+  }
+
+  void QualityController::SetQuality(uint32_t quality)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Quality = quality;
+  }
+
+  std::optional<uint32_t> QualityController::Update()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    Clock::time_point now = Clock::now();
+    if (now - m_LastStep < StepInterval)
+      return std::nullopt;
+
+    double stepSeconds = std::chrono::duration<double>(now - m_LastStep).count();
+    m_Throughput = static_cast<double>(m_StepBytes) / stepSeconds;
+    m_StepBytes = 0;
+    m_LastStep = now;
+
+    UpdatePacingRate();
+
+    uint32_t quality = m_Quality;
+    if (IsCongested())
+    {
+      quality = std::max(MinQuality, static_cast<uint32_t>(m_Quality * QualityDecrease));
+      m_LastDecrease = now;
+    }
+    else if (now - m_LastDecrease >= DecreaseHold)
+    {
+      quality = std::min(MaxQuality, m_Quality + QualityIncrease);
+    }
+    m_LastChildDroppedFrames = m_ChildDroppedFrames;
+
+    if (quality == m_Quality)
+      return std::nullopt;
+
+    YK_INFO("[QUALITY] {} -> {} (latency {:.1f}ms, jitter {:.1f}ms, loss {:.1f}%, decode {:.1f}ms, {:.0f}KB/s, child queue {}KB)",
+      m_Quality, quality, m_LatencyMs, m_JitterMs, m_LossRate * 100.0, m_DecodeMs, m_Throughput / 1024.0, m_ChildQueuedBytes / 1024);
+    m_Quality = quality;
+    return quality;
+  }
+
+  double QualityController::GetThroughput() const
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Throughput;
+  }
+
+  uint64_t QualityController::GetPacingRate() const
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_PacingRate;
+  }
+
+  void QualityController::UpdatePacingRate()
+  {
+    // Nothing arrived this step, the screen did not change, which says nothing about
+    // the link either
+    if (m_Throughput <= 0.0)
+      return;
+
+    // Pacing starts with the first congestion, at what made it through meanwhile. From
+    // then on it only climbs while the link keeps up, a child sending little for a
+    // while does not pin itself down to that
+    double rate = m_PacingRate;
+    if (IsCongested())
+      rate = std::max(MinPacingRate, m_Throughput * PacingGain);
+    else if (m_PacingRate > 0)
+      rate = std::max(rate, m_Throughput * PacingGain);
+
+    if (std::abs(rate - static_cast<double>(m_PacingRate)) > m_PacingRate * PacingChange)
+      m_PacingRate = static_cast<uint64_t>(rate);
+  }
+
+  bool QualityController::IsCongested() const
+  {
+    // Frames taking longer than the target from capture to arrival
+    if (m_LatencyMs > TargetLatencyMs)
+      return true;
+
+    // Frames arriving unevenly, the link is queueing them somewhere
+    if (m_JitterMs > JitterLimitMs)
+      return true;
+
+    // Frames taking longer to decode than they take to arrive
+    if (m_DecodeMs > DecodeBudgetMs)
+      return true;
+
+    // What waits in the child's send queue would take longer than the target to get
+    // here at the rate frames are arriving
+    if (m_ChildQueuedBytes > 0 && m_FrameBytes > 0.0)
+    {
+      if (m_Throughput <= 0.0 || m_ChildQueuedBytes / m_Throughput * 1000.0 > TargetLatencyMs)
+        return true;
+    }
+
+    // Frames dropped by the child before they left, or lost on the way
+    if (m_ChildDroppedFrames > m_LastChildDroppedFrames)
+      return true;
+    if (m_LossRate > LossLimit)
+      return true;
+
+    return false;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace rpc
+{
+  // Picks the JPEG quality of one child's frames from what the link and the parent
+  // can sustain. Every step the signals are checked, if any of them shows congestion
+  // the quality is cut by a fraction, otherwise it creeps up by a few points (AIMD),
+  // so it settles just under what the link can take while frames keep arriving
+  // within the target latency.
+  class QualityController
+  {
+  public:
+    QualityController(uint32_t quality = 50);
+
+    // Signals, may be called from any thread
+    // Timestamps in microseconds. "captureTime" is on the child's clock, "localCaptureTime"
+    // is the same moment on the parent's clock, 0 until the clocks are synced
+    void OnFrameReceived(size_t bytes, uint64_t captureTime, uint64_t localCaptureTime, uint64_t arrivalTime);
+    void OnFrameDecoded(double decodeMs);
+    // The child's counters: bytes waiting in its send queue, frames it dropped before
+    // they left (superseded, or the shared memory ring was full) and frames it sent
+    void OnChildStats(uint64_t queuedBytes, uint64_t droppedFrames, uint64_t sentFrames);
+
+    // The quality was set by hand, carry on from there
+    void SetQuality(uint32_t quality);
+
+    // Runs a control step when one is due, returns the new quality if it changed
+    std::optional<uint32_t> Update();
+
+    double GetThroughput() const;
+    // Bytes per second the child should pace its frames at, 0 until the link has
+    // first shown congestion
+    uint64_t GetPacingRate() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    bool IsCongested() const;
+    void UpdatePacingRate();
+
+  private:
+    mutable std::mutex m_Mutex;
+
+    uint32_t m_Quality;
+    Clock::time_point m_LastStep = Clock::now();
+    Clock::time_point m_LastDecrease = {};
+
+    // EWMAs of how much the time from capture to arrival varies from one frame to the
+    // next (jitter), and of that time itself once the clocks are synced (latency). The
+    // child only captures when the screen changes, so the gaps between frames say
+    // nothing about the link, the capture timestamps do
+    uint64_t m_LastCaptureTime = 0;
+    int64_t m_LastTransit = 0;
+    double m_JitterMs = 0.0;
+    double m_LatencyMs = 0.0;
+    double m_FrameBytes = 0.0;
+
+    // Bytes received since the last step, and the resulting throughput
+    size_t m_StepBytes = 0;
+    double m_Throughput = 0.0;
+    uint64_t m_PacingRate = 0;
+
+    double m_DecodeMs = 0.0;
+
+    uint64_t m_ChildQueuedBytes = 0;
+    uint64_t m_ChildDroppedFrames = 0;
+    uint64_t m_LastChildDroppedFrames = 0;
+
+    // Frames lost on the way (datagrams the parity could not repair), from the frames the
+    // child says it sent against the frames received meanwhile
+    bool m_HasChildStats = false;
+    uint64_t m_FramesReceived = 0;
+    uint64_t m_LossFramesSent = 0;
+    uint64_t m_LossFramesReceived = 0;
+    double m_LossRate = 0.0;
+  };
+}
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 
 #include <YKLib.h>
 
@@ -28,13 +29,6 @@ namespace rpc
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    glGenTextures(1, &m_CurrentFrameTexture);
-    glBindTexture(GL_TEXTURE_2D, m_CurrentFrameTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     float vertices[] =
     {
       -1.f, -1.f,    0.f, 0.f,
@@ -111,7 +105,8 @@ void main() {
   Renderer::~Renderer()
   {
     glDeleteProgram(m_ShaderProgram);
-    glDeleteTextures(1, &m_CurrentFrameTexture);
+    for (auto& [id, texture] : m_FrameTextures)
+      glDeleteTextures(1, &texture.texture);
 
     glDeleteBuffers(1, &m_VBO);
     glDeleteBuffers(1, &m_EBO);
@@ -126,35 +121,107 @@ void main() {
     glClear(GL_COLOR_BUFFER_BIT);
   }
 
-  void Renderer::UpdateTexture()
+  void Renderer::UpdateTexture(ChildFrame& frame, FrameTexture& texture)
   {
-    glBindTexture(GL_TEXTURE_2D, m_CurrentFrameTexture);
-
     std::vector<uint8_t> localPixels;
+    uint32_t width, height;
     {
-      std::lock_guard<std::mutex> lock(g_framePixelsMutex);
-      localPixels = g_framePixelsData;
+      std::lock_guard<std::mutex> lock(frame.mutex);
+      if (!frame.newFrame)
+        return;
+
+      localPixels = std::move(frame.pixels);
+      width = frame.width;
+      height = frame.height;
+      frame.newFrame = false;
+      frame.presentedCaptureTime = frame.captureTime;
     }
 
-    std::lock_guard<std::mutex> lock1(g_frameSizeMutex);
-    if (g_frameWidth != g_currentFrameWidth || g_frameHeight != g_currentFrameHeight)
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    if (width != texture.width || height != texture.height)
     {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, g_frameWidth, g_frameHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, localPixels.data());
-      g_currentFrameWidth = g_frameWidth;
-      g_currentFrameHeight = g_frameHeight;
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, localPixels.data());
+      texture.width = width;
+      texture.height = height;
     }
     else
     {
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, g_currentFrameWidth, g_currentFrameHeight, GL_RGB, GL_UNSIGNED_BYTE, localPixels.data());
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height, GL_RGB, GL_UNSIGNED_BYTE, localPixels.data());
     }
   }
 
-  void Renderer::Render()
+  void Renderer::Render(const std::vector<std::shared_ptr<ChildFrame>>& frames, size_t selected)
   {
+    // Forget the textures of children that are gone
+    for (auto it = m_FrameTextures.begin(); it != m_FrameTextures.end();)
+    {
+      bool found = std::any_of(frames.begin(), frames.end(), [&](const std::shared_ptr<ChildFrame>& frame) { return frame->id == it->first; });
+      if (found)
+      {
+        ++it;
+        continue;
+      }
+
+      glDeleteTextures(1, &it->second.texture);
+      it = m_FrameTextures.erase(it);
+    }
+
+    if (frames.empty())
+      return;
+
+    int32_t windowWidth, windowHeight;
+    glfwGetFramebufferSize(m_Window, &windowWidth, &windowHeight);
+
+    // As square a grid as the number of children allows
+    const int32_t columns = static_cast<int32_t>(std::ceil(std::sqrt(static_cast<float>(frames.size()))));
+    const int32_t rows = (static_cast<int32_t>(frames.size()) + columns - 1) / columns;
+    const int32_t cellWidth = windowWidth / columns;
+    const int32_t cellHeight = windowHeight / rows;
+    const int32_t border = frames.size() > 1 ? 2 : 0;
+
     glUseProgram(m_ShaderProgram);
-    glBindTexture(GL_TEXTURE_2D, m_CurrentFrameTexture);
     glBindVertexArray(m_VAO);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glEnable(GL_SCISSOR_TEST);
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      auto [it, created] = m_FrameTextures.try_emplace(frames[i]->id);
+      FrameTexture& texture = it->second;
+      if (created)
+      {
+        glGenTextures(1, &texture.texture);
+        glBindTexture(GL_TEXTURE_2D, texture.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      }
+
+      UpdateTexture(*frames[i], texture);
+
+      // Cells are laid out left to right, top to bottom
+      const int32_t x = static_cast<int32_t>(i) % columns * cellWidth;
+      const int32_t y = windowHeight - (static_cast<int32_t>(i) / columns + 1) * cellHeight;
+
+      if (i == selected && border > 0)
+      {
+        glScissor(x, y, cellWidth, cellHeight);
+        glClearColor(0.9f, 0.6f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+      }
+
+      if (texture.width == 0 || texture.height == 0)
+        continue;
+
+      glScissor(x + border, y + border, cellWidth - border * 2, cellHeight - border * 2);
+      glViewport(x + border, y + border, cellWidth - border * 2, cellHeight - border * 2);
+      glBindTexture(GL_TEXTURE_2D, texture.texture);
+      glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(0, 0, windowWidth, windowHeight);
   }
 
   void Renderer::Update()
@@ -196,21 +263,25 @@ void main() {
 
   void Renderer::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
   {
+    if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
+    {
+      g_selectedChild++;
+    }
+    if (key == GLFW_KEY_A && action == GLFW_PRESS)
+    {
+      g_autoQualityToggle = true;
+    }
     if (key == GLFW_KEY_R && action == GLFW_PRESS)
     {
-      g_newFrameQuality = 50;
+      g_frameQualityReset = true;
     }
     if (key == GLFW_KEY_UP && action == GLFW_PRESS)
     {
-      g_newFrameQuality -= g_newFrameQuality % 5;
-      g_newFrameQuality += 5;
+      g_frameQualitySteps++;
     }
     if (key == GLFW_KEY_DOWN && action == GLFW_PRESS)
     {
-      g_newFrameQuality -= g_newFrameQuality % 5;
-      g_newFrameQuality -= 5;
+      g_frameQualitySteps--;
     }
-
-    g_newFrameQuality = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(g_newFrameQuality), 1, 100));
   }
 }
\ No newline at end of file
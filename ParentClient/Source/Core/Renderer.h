@@ -2,10 +2,15 @@
 
 #include <cstdint>
 #include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <GLFW/glfw3.h>
 #include <glad/gl.h>
 
+#include "Core/Common.h"
+
 namespace rpc
 {
   class Renderer
@@ -15,19 +20,28 @@ namespace rpc
     ~Renderer();
 
     void Clear();
-    void UpdateTexture();
-    void Render();
+    // Draws every frame in a grid, the selected one is outlined
+    void Render(const std::vector<std::shared_ptr<ChildFrame>>& frames, size_t selected);
     void Update();
 
     bool IsRunning();
 
   private:
+    struct FrameTexture
+    {
+      GLuint texture = 0;
+      uint32_t width = 0;
+      uint32_t height = 0;
+    };
+
+    void UpdateTexture(ChildFrame& frame, FrameTexture& texture);
+
     static void CheckCompileErrors(unsigned int shader, const std::string& type);
     static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
   private:
     GLFWwindow* m_Window = nullptr;
-    GLuint m_CurrentFrameTexture = 0;
+    std::unordered_map<uint32_t, FrameTexture> m_FrameTextures;
     GLuint m_ShaderProgram = 0;
     GLuint m_VAO = 0;
     GLuint m_VBO = 0;
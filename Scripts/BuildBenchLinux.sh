@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds NetBench for Linux three times, on epoll, on io_uring and with coroutine
+# connections, each into a Bin directory of its own. Needs premake5 on the PATH and
+# liburing for the io_uring build. Extra arguments are passed to premake. Nothing
+# else builds the io_uring variant, it is untested until this has been run and
+# NetBench iobackend compared on a Linux host
+set -e
+cd "$(dirname "$0")/.."
+
+for options in "" "--io-uring" "--net-coroutines"
+do
+  premake5 --file=premake5.lua $options "$@" gmake2
+  make NetBench config=release_linux -j"$(nproc)"
+done
\ No newline at end of file
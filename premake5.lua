@@ -1,5 +1,26 @@
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 
+newoption
+{
+  trigger = "io-uring",
+  description = "Linux only, asio runs socket I/O on io_uring instead of epoll (needs asio 1.21+ and liburing). Untested: not built or run by any CI, try it with Scripts/BuildBenchLinux.sh and NetBench iobackend first"
+}
+
+newoption
+{
+  trigger = "net-coroutines",
+  description = "Connections read and write with C++20 coroutines instead of callback chains"
+}
+
+-- Builds with another socket backend or connection loop get binaries of their own,
+-- so they can sit next to each other and be benchmarked against each other
+if _OPTIONS["io-uring"] then
+  outputdir = outputdir .. "-io_uring"
+end
+if _OPTIONS["net-coroutines"] then
+  outputdir = outputdir .. "-coroutines"
+end
+
 IncludeDir = {}
 IncludeDir["asio"]          = "Deps/asio/asio/include"
 IncludeDir["stb"]           = "Deps/stb"
@@ -65,6 +86,14 @@ workspace "RemoteParentalControl"
     architecture "x64"
     defines { "PLATFORM_MACOS", "ARCH_X64" }
 
+  -- Every project including asio must agree on its backend
+  filter { "platforms:Linux", "options:io-uring" }
+    defines { "ASIO_HAS_IO_URING", "ASIO_DISABLE_EPOLL" }
+    links { "uring" }
+
+  filter { "options:net-coroutines" }
+    defines { "RPC_NET_COROUTINES" }
+
     -- Configuration Filters
   filter { "configurations:Debug" }
     symbols "On"
@@ -498,4 +527,88 @@ project "ChildClient"
     defines
     {
       "CONFIG_FINAL"
-    }
\ No newline at end of file
+    }
+
+group "Bench"
+
+project "NetBench"
+  location "Bench"
+  language "C++"
+  cppdialect "C++latest"
+  staticruntime "On"
+  kind "ConsoleApp"
+  
+  targetdir ("Bin/" .. outputdir .. "/%{prj.name}")
+  objdir ("Bin-Int/" .. outputdir .. "/%{prj.name}")
+  
+  files
+  {
+    "Bench/Source/**.cpp",
+    "Bench/Source/**.h"
+  }
+  
+  includedirs
+  {
+    "Bench/Source",
+    "%{IncludeDir.asio}",
+    "%{IncludeDir.NetCommon}",
+    "%{IncludeDir.CoreCommon}",
+    "%{IncludeDir.YKLib}"
+  }
+
+  defines
+  {
+    "ASIO_STANDALONE"
+  }
+
+  links
+  {
+    "NetCommon",
+    "CoreCommon",
+    "YKLib"
+  }
+
+  -- SyscallCounter.cpp finds libc's socket calls with dlsym
+  filter { "platforms:Linux" }
+    links
+    {
+      "dl",
+      "pthread"
+    }
+
+  filter { "platforms:Win32 or Win64" }
+    defines
+    {
+      "WIN32_LEAN_AND_MEAN",
+      "_WIN32_WINNT=0x0601"
+    }
+    links
+    {
+      "Ws2_32.lib"
+    }
+
+  filter { "configurations:Debug or DebugDLL" }
+    symbols "On"
+    optimize "Off"
+    defines
+    {
+      "CONFIG_DEBUG"
+    }
+
+  filter { "configurations:Release or ReleaseDLL" }
+    symbols "Off"
+    optimize "Full"
+    defines
+    {
+      "CONFIG_RELEASE"
+    }
+
+  filter { "configurations:Final or FinalDLL" }
+    symbols "Off"
+    optimize "Full"
+    defines
+    {
+      "CONFIG_FINAL"
+    }
+
+group ""
\ No newline at end of file